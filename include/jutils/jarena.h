@@ -0,0 +1,234 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+#include "math/math.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+namespace jutils
+{
+    // Linear allocator: allocation is a pointer bump, memory is freed only by rewind(), reset() or release().
+    // Chunks are kept after rewind() and reset() and reused by next allocations. Destructors of created objects are not called
+    class jarena
+    {
+    public:
+
+        static constexpr std::size_t default_chunk_size = 64 * 1024;
+
+        struct marker
+        {
+            void* chunk = nullptr;
+            std::size_t offset = 0;
+        };
+
+        jarena() = default;
+        explicit jarena(const std::size_t chunkSize) : defaultChunkSize(jutils::math::max(chunkSize, static_cast<std::size_t>(1))) {}
+        jarena(const jarena&) = delete;
+        jarena(jarena&&) noexcept = delete;
+        ~jarena() { release(); }
+
+        jarena& operator=(const jarena&) = delete;
+        jarena& operator=(jarena&&) noexcept = delete;
+
+        // Bytes allocated since the last reset(), including alignment padding
+        [[nodiscard]] inline std::size_t getUsedSize() const;
+        // Bytes in all chunks
+        [[nodiscard]] std::size_t getReservedSize() const { return reservedSize; }
+
+        [[nodiscard]] inline void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+        template<typename Type>
+        [[nodiscard]] Type* allocate(const std::size_t count)
+        {
+            if ((count == 0) || (count > (std::numeric_limits<std::size_t>::max() / sizeof(Type))))
+            {
+                return nullptr;
+            }
+            return static_cast<Type*>(allocate(sizeof(Type) * count, alignof(Type)));
+        }
+        template<typename Type, typename... Args>
+        [[nodiscard]] Type* create(Args&&... args)
+        {
+            Type* object = allocate<Type>(1);
+            memory::construct(object, std::forward<Args>(args)...);
+            return object;
+        }
+
+        [[nodiscard]] marker getMarker() const { return { currentChunk, currentChunk != nullptr ? currentChunk->usedSize : 0 }; }
+        // Frees everything allocated after the marker was taken
+        inline void rewind(const marker& arenaMarker);
+        inline void reset() { rewind({}); }
+        // Frees chunks
+        inline void release();
+
+    private:
+
+        struct alignas(std::max_align_t) chunk_type
+        {
+            chunk_type* nextChunk = nullptr;
+            std::size_t size = 0;
+            std::size_t usedSize = 0;
+
+            [[nodiscard]] uint8* getData() { return reinterpret_cast<uint8*>(this + 1); }
+        };
+
+        std::size_t defaultChunkSize = default_chunk_size;
+        chunk_type* firstChunk = nullptr;
+        chunk_type* currentChunk = nullptr;
+        std::size_t reservedSize = 0;
+
+
+        [[nodiscard]] static void* _allocateInChunk(chunk_type* chunk, std::size_t size, std::size_t alignment);
+        [[nodiscard]] inline chunk_type* _addChunk(std::size_t size, std::size_t alignment);
+    };
+
+    inline void* jarena::_allocateInChunk(chunk_type* chunk, const std::size_t size, const std::size_t alignment)
+    {
+        const std::uintptr_t data = reinterpret_cast<std::uintptr_t>(chunk->getData());
+        const std::uintptr_t position = (data + chunk->usedSize + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+        const std::size_t offset = static_cast<std::size_t>(position - data);
+        if ((offset > chunk->size) || (size > (chunk->size - offset)))
+        {
+            return nullptr;
+        }
+        chunk->usedSize = offset + size;
+        return reinterpret_cast<void*>(position);
+    }
+
+    inline void* jarena::allocate(std::size_t size, std::size_t alignment)
+    {
+        size = jutils::math::max(size, static_cast<std::size_t>(1));
+        alignment = jutils::math::max(alignment, static_cast<std::size_t>(1));
+        if ((alignment & (alignment - 1)) != 0)
+        {
+            return nullptr;
+        }
+
+        while (currentChunk != nullptr)
+        {
+            void* data = _allocateInChunk(currentChunk, size, alignment);
+            if (data != nullptr)
+            {
+                return data;
+            }
+            // Chunks after the current one are empty, they are left by rewind()
+            if (currentChunk->nextChunk == nullptr)
+            {
+                break;
+            }
+            currentChunk = currentChunk->nextChunk;
+        }
+
+        chunk_type* chunk = _addChunk(size, alignment);
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+        currentChunk = chunk;
+        return _allocateInChunk(chunk, size, alignment);
+    }
+    inline jarena::chunk_type* jarena::_addChunk(const std::size_t size, const std::size_t alignment)
+    {
+        constexpr std::size_t maxDataSize = std::numeric_limits<std::size_t>::max() - sizeof(chunk_type);
+        if ((alignment > maxDataSize) || (size > (maxDataSize - alignment)))
+        {
+            return nullptr;
+        }
+        const std::size_t dataSize = jutils::math::min(jutils::math::max(defaultChunkSize, size + alignment - 1), maxDataSize);
+        const std::size_t allocationSize = sizeof(chunk_type) + dataSize;
+
+        // Chunk could be bigger than memory::allocate() can count, so it's allocated in bytes
+        chunk_type* chunk = static_cast<chunk_type*>(memory::allocateBytes(allocationSize, alignof(chunk_type)));
+        memory::construct(chunk);
+        chunk->size = dataSize;
+        reservedSize += allocationSize;
+        if (currentChunk != nullptr)
+        {
+            chunk->nextChunk = currentChunk->nextChunk;
+            currentChunk->nextChunk = chunk;
+        }
+        else
+        {
+            firstChunk = chunk;
+        }
+        return chunk;
+    }
+
+    inline void jarena::rewind(const marker& arenaMarker)
+    {
+        chunk_type* markerChunk = arenaMarker.chunk != nullptr ? static_cast<chunk_type*>(arenaMarker.chunk) : firstChunk;
+        if (markerChunk == nullptr)
+        {
+            return;
+        }
+
+        for (chunk_type* chunk = markerChunk; chunk != nullptr; chunk = chunk->nextChunk)
+        {
+            chunk->usedSize = chunk == arenaMarker.chunk ? arenaMarker.offset : 0;
+            if (chunk == currentChunk)
+            {
+                break;
+            }
+        }
+        currentChunk = markerChunk;
+    }
+    inline void jarena::release()
+    {
+        chunk_type* chunk = firstChunk;
+        while (chunk != nullptr)
+        {
+            chunk_type* nextChunk = chunk->nextChunk;
+            memory::destruct(chunk);
+            memory::deallocateBytes(chunk, alignof(chunk_type));
+            chunk = nextChunk;
+        }
+        firstChunk = nullptr;
+        currentChunk = nullptr;
+        reservedSize = 0;
+    }
+    inline std::size_t jarena::getUsedSize() const
+    {
+        std::size_t size = 0;
+        for (const chunk_type* chunk = firstChunk; chunk != nullptr; chunk = chunk->nextChunk)
+        {
+            size += chunk->usedSize;
+            if (chunk == currentChunk)
+            {
+                break;
+            }
+        }
+        return size;
+    }
+
+    // Adapter for std::pmr containers, deallocation does nothing
+    class jarena_resource final : public std::pmr::memory_resource
+    {
+    public:
+        explicit jarena_resource(jarena& arena) : ownerArena(&arena) {}
+
+        [[nodiscard]] jarena& getArena() const { return *ownerArena; }
+
+    protected:
+
+        virtual void* do_allocate(const std::size_t bytes, const std::size_t alignment) override
+        {
+            void* data = ownerArena->allocate(bytes, alignment);
+            if (data == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return data;
+        }
+        virtual void do_deallocate(void*, std::size_t, std::size_t) override {}
+        [[nodiscard]] virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    private:
+
+        jarena* ownerArena = nullptr;
+    };
+}
@@ -0,0 +1,342 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jasync_task_queue.h"
+
+#include <array>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+
+namespace jutils
+{
+    // Awaiter is the queued task itself, so resuming a coroutine on a worker doesn't allocate.
+    // Coroutine is resumed inline if the queue is not initialized and is never resumed if the queue drops the task
+    class jasync_schedule_awaiter final : public jasync_task
+    {
+    public:
+        jasync_schedule_awaiter(jasync_task_queue_base& queue, const jasync_task_priority priority)
+            : ownerQueue(&queue), awaiterPriority(priority)
+        {}
+
+        [[nodiscard]] bool await_ready() const { return !ownerQueue->isValid(); }
+        bool await_suspend(const std::coroutine_handle<> handle)
+        {
+            coroutineHandle = handle;
+            return ownerQueue->addTask(this, awaiterPriority);
+        }
+        void await_resume() const {}
+
+        virtual void run() override { coroutineHandle.resume(); }
+        [[nodiscard]] virtual bool shouldDeleteAfterExecution() const override { return false; }
+
+    private:
+
+        jasync_task_queue_base* ownerQueue = nullptr;
+        jasync_task_priority awaiterPriority = jasync_task_priority::normal;
+        std::coroutine_handle<> coroutineHandle = nullptr;
+    };
+
+    inline jasync_schedule_awaiter jasync_task_queue_base::schedule(const jasync_task_priority priority)
+    {
+        return { *this, priority };
+    }
+
+    template<typename T = void>
+    class jasync_coroutine;
+}
+
+namespace jutils_private
+{
+    using jutils::int32;
+
+    // Joins several coroutines, the last finished one resumes the continuation or releases the counter
+    struct jasync_coroutine_latch
+    {
+        std::atomic<int32> pendingCount = 0;
+        std::coroutine_handle<> continuation = nullptr;
+        jutils::jasync_task_queue_base* queue = nullptr;
+        jutils::jasync_task_counter* counter = nullptr;
+
+        [[nodiscard]] std::coroutine_handle<> release()
+        {
+            if (pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            {
+                return std::noop_coroutine();
+            }
+            if (queue != nullptr)
+            {
+                // Latch could be destroyed by the waiting thread right after this call
+                queue->releaseCounter(*counter);
+                return std::noop_coroutine();
+            }
+            return continuation;
+        }
+    };
+
+    class jasync_coroutine_promise_base
+    {
+    public:
+
+        struct final_awaiter
+        {
+            [[nodiscard]] bool await_ready() const noexcept { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(const std::coroutine_handle<Promise> handle) noexcept
+            {
+                jasync_coroutine_promise_base& promise = handle.promise();
+                if (promise.latch != nullptr)
+                {
+                    return promise.latch->release();
+                }
+                return promise.continuation != nullptr ? promise.continuation : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        final_awaiter final_suspend() const noexcept { return {}; }
+        // Exception is rethrown to the awaiting coroutine or by jasync_sync_wait()
+        void unhandled_exception() { exception = std::current_exception(); }
+        void rethrowException() const
+        {
+            if (exception != nullptr)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        std::coroutine_handle<> continuation = nullptr;
+        jasync_coroutine_latch* latch = nullptr;
+        std::exception_ptr exception = nullptr;
+    };
+
+    template<typename T>
+    class jasync_coroutine_promise : public jasync_coroutine_promise_base
+    {
+    public:
+
+        jutils::jasync_coroutine<T> get_return_object();
+
+        template<typename U>
+        void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+        std::optional<T> result;
+    };
+    template<>
+    class jasync_coroutine_promise<void> : public jasync_coroutine_promise_base
+    {
+    public:
+
+        jutils::jasync_coroutine<void> get_return_object();
+
+        void return_void() const {}
+    };
+
+    struct jasync_coroutine_handle
+    {
+        std::coroutine_handle<> handle = nullptr;
+        jasync_coroutine_promise_base* promise = nullptr;
+    };
+
+    template<typename Container>
+    class jasync_when_all_awaiter
+    {
+    public:
+        explicit jasync_when_all_awaiter(Container&& handles) : coroutineHandles(std::move(handles)) {}
+
+        [[nodiscard]] bool await_ready() const { return coroutineHandles.empty(); }
+        bool await_suspend(const std::coroutine_handle<> handle)
+        {
+            latch.continuation = handle;
+            latch.pendingCount.store(static_cast<int32>(coroutineHandles.size()) + 1, std::memory_order_relaxed);
+            for (const auto& coroutineHandle : coroutineHandles)
+            {
+                // Finished coroutine can't be resumed again, it's released right away
+                if ((coroutineHandle.handle == nullptr) || coroutineHandle.handle.done())
+                {
+                    latch.pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+                    continue;
+                }
+                coroutineHandle.promise->latch = &latch;
+                coroutineHandle.handle.resume();
+            }
+            // If every coroutine has already finished there is nothing to wait for
+            return latch.pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+        void await_resume() const {}
+
+    private:
+
+        Container coroutineHandles;
+        jasync_coroutine_latch latch;
+    };
+}
+
+namespace jutils
+{
+    // Lazy coroutine, it starts when it's awaited and resumes the awaiting coroutine when it's finished
+    template<typename T>
+    class jasync_coroutine
+    {
+        friend jutils_private::jasync_coroutine_promise<T>;
+
+    public:
+
+        using promise_type = jutils_private::jasync_coroutine_promise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        jasync_coroutine() = default;
+        jasync_coroutine(const jasync_coroutine&) = delete;
+        jasync_coroutine(jasync_coroutine&& coroutine) noexcept : coroutineHandle(coroutine.coroutineHandle) { coroutine.coroutineHandle = nullptr; }
+        ~jasync_coroutine() { _destroy(); }
+
+        jasync_coroutine& operator=(const jasync_coroutine&) = delete;
+        jasync_coroutine& operator=(jasync_coroutine&& coroutine) noexcept
+        {
+            if (this != &coroutine)
+            {
+                _destroy();
+                coroutineHandle = coroutine.coroutineHandle;
+                coroutine.coroutineHandle = nullptr;
+            }
+            return *this;
+        }
+
+        [[nodiscard]] bool isValid() const { return coroutineHandle != nullptr; }
+        [[nodiscard]] bool isDone() const { return isValid() && coroutineHandle.done(); }
+        // Valid only after the coroutine is finished, rethrows the exception that escaped the coroutine
+        template<typename U = T> requires (!std::is_void_v<U>)
+        [[nodiscard]] U& getResult() const
+        {
+            coroutineHandle.promise().rethrowException();
+            return *coroutineHandle.promise().result;
+        }
+        // Does nothing if the coroutine finished without an exception
+        void rethrowException() const
+        {
+            if (coroutineHandle != nullptr)
+            {
+                coroutineHandle.promise().rethrowException();
+            }
+        }
+
+        auto operator co_await() & noexcept { return awaiter<false>{ coroutineHandle }; }
+        auto operator co_await() && noexcept { return awaiter<true>{ coroutineHandle }; }
+
+        [[nodiscard]] jutils_private::jasync_coroutine_handle getHandle() const
+        {
+            return { coroutineHandle, coroutineHandle != nullptr ? &coroutineHandle.promise() : nullptr };
+        }
+
+    private:
+
+        template<bool MoveResult>
+        struct awaiter
+        {
+            handle_type handle = nullptr;
+
+            [[nodiscard]] bool await_ready() const noexcept { return (handle == nullptr) || handle.done(); }
+            std::coroutine_handle<> await_suspend(const std::coroutine_handle<> continuation) noexcept
+            {
+                handle.promise().continuation = continuation;
+                return handle;
+            }
+            // Moved result is returned by value, so it doesn't dangle after the temporary coroutine is destroyed
+            std::conditional_t<MoveResult, T, std::add_lvalue_reference_t<T>> await_resume()
+            {
+                if (handle != nullptr)
+                {
+                    handle.promise().rethrowException();
+                }
+                if constexpr (std::is_void_v<T>)
+                {
+                    return;
+                }
+                else if constexpr (MoveResult)
+                {
+                    return std::move(*handle.promise().result);
+                }
+                else
+                {
+                    return static_cast<T&>(*handle.promise().result);
+                }
+            }
+        };
+
+        handle_type coroutineHandle = nullptr;
+
+
+        explicit jasync_coroutine(const handle_type handle) : coroutineHandle(handle) {}
+
+        void _destroy()
+        {
+            if (coroutineHandle != nullptr)
+            {
+                coroutineHandle.destroy();
+                coroutineHandle = nullptr;
+            }
+        }
+    };
+
+    // Starts all coroutines and resumes the awaiting one when all of them are finished, results stay in the coroutines
+    template<typename... Ts>
+    [[nodiscard]] auto jasync_when_all(jasync_coroutine<Ts>&... coroutines)
+    {
+        using handles_type = std::array<jutils_private::jasync_coroutine_handle, sizeof...(Ts)>;
+        return jutils_private::jasync_when_all_awaiter<handles_type>(handles_type{ coroutines.getHandle()... });
+    }
+    template<typename T>
+    [[nodiscard]] auto jasync_when_all(std::vector<jasync_coroutine<T>>& coroutines)
+    {
+        using handles_type = std::vector<jutils_private::jasync_coroutine_handle>;
+        handles_type handles;
+        handles.reserve(coroutines.size());
+        for (const auto& coroutine : coroutines)
+        {
+            handles.push_back(coroutine.getHandle());
+        }
+        return jutils_private::jasync_when_all_awaiter<handles_type>(std::move(handles));
+    }
+
+    // Starts the coroutine on the calling thread and executes queued tasks until it's finished.
+    // Invalid coroutine is not started, it has a result only if T is void
+    template<typename T>
+    T jasync_sync_wait(jasync_task_queue_base& queue, jasync_coroutine<T> coroutine)
+    {
+        jasync_task_counter counter;
+        jutils_private::jasync_coroutine_latch latch;
+        latch.pendingCount.store(1, std::memory_order_relaxed);
+        latch.queue = &queue;
+        latch.counter = &counter;
+
+        const jutils_private::jasync_coroutine_handle handle = coroutine.getHandle();
+        if (coroutine.isValid() && !handle.handle.done())
+        {
+            handle.promise->latch = &latch;
+            queue.retainCounter(counter);
+            handle.handle.resume();
+            queue.wait(counter);
+        }
+        coroutine.rethrowException();
+        if constexpr (!std::is_void_v<T>)
+        {
+            return std::move(coroutine.getResult());
+        }
+    }
+}
+
+namespace jutils_private
+{
+    template<typename T>
+    jutils::jasync_coroutine<T> jasync_coroutine_promise<T>::get_return_object()
+    {
+        return jutils::jasync_coroutine<T>(jutils::jasync_coroutine<T>::handle_type::from_promise(*this));
+    }
+    inline jutils::jasync_coroutine<void> jasync_coroutine_promise<void>::get_return_object()
+    {
+        return jutils::jasync_coroutine<void>(jutils::jasync_coroutine<void>::handle_type::from_promise(*this));
+    }
+}
@@ -0,0 +1,184 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jasync_task_queue.h"
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+namespace jutils_private
+{
+    using jutils::int32;
+    using jutils::int64;
+
+    template<typename Body>
+    class jasync_parallel_range_task;
+
+    template<typename Body>
+    struct jasync_parallel_context
+    {
+        jutils::jasync_task_queue_base* queue = nullptr;
+        Body* body = nullptr;
+        int64 grainSize = 1;
+
+        jasync_parallel_range_task<Body>* tasks = nullptr;
+        int32 maxTasksCount = 0;
+        std::atomic<int32> tasksCount = 0;
+        jutils::jasync_task_counter counter;
+    };
+
+    // Splits its range in halves until it fits into the grain size, right halves go back to the queue so idle workers can pick them up
+    template<typename Body>
+    class jasync_parallel_range_task final : public jutils::jasync_task
+    {
+    public:
+        jasync_parallel_range_task(jasync_parallel_context<Body>* context, const int32 taskIndex, const int64 begin, const int64 end)
+            : parallelContext(context), index(taskIndex), rangeBegin(begin), rangeEnd(end)
+        {}
+
+        virtual void run() override
+        {
+            while ((rangeEnd - rangeBegin) > parallelContext->grainSize)
+            {
+                const int64 middle = rangeBegin + (rangeEnd - rangeBegin) / 2;
+                const int32 taskIndex = parallelContext->tasksCount.fetch_add(1, std::memory_order_relaxed);
+                jasync_parallel_range_task* task = parallelContext->tasks + taskIndex;
+                jutils::memory::construct(task, parallelContext, taskIndex, middle, rangeEnd);
+                parallelContext->queue->addTask(task, &parallelContext->counter);
+                rangeEnd = middle;
+            }
+            (*parallelContext->body)(index, rangeBegin, rangeEnd);
+        }
+        [[nodiscard]] virtual bool shouldDeleteAfterExecution() const override { return false; }
+
+    private:
+
+        jasync_parallel_context<Body>* parallelContext = nullptr;
+        int32 index = 0;
+        int64 rangeBegin = 0;
+        int64 rangeEnd = 0;
+    };
+
+    // Finer grain doesn't add parallelism, only tasks, so chunks count is limited by the worker count
+    constexpr int64 jasync_parallel_max_chunks_per_worker = 64;
+
+    [[nodiscard]] inline int64 jasync_parallel_grain_size(const jutils::jasync_task_queue_base& queue, const int64 rangeSize, const int64 grainSize)
+    {
+        const int64 workerCount = jutils::math::max(queue.getWorkerCount(), 1);
+        if (grainSize <= 0)
+        {
+            return jutils::math::max(rangeSize / (workerCount * 8), 1);
+        }
+        const int64 maxChunksCount = workerCount * jasync_parallel_max_chunks_per_worker;
+        return jutils::math::max(grainSize, rangeSize / maxChunksCount + ((rangeSize % maxChunksCount) > 0 ? 1 : 0));
+    }
+    [[nodiscard]] inline int32 jasync_parallel_max_tasks_count(const int64 rangeSize, const int64 grainSize)
+    {
+        // Every split leaves both halves bigger than half of the grain
+        const int64 tasksCount = rangeSize / (grainSize / 2 + grainSize % 2) + 1;
+        return static_cast<int32>(jutils::math::min(tasksCount, static_cast<int64>(std::numeric_limits<int32>::max())));
+    }
+
+    // Returns count of used tasks, body receives index of the task as the first argument
+    template<typename Body>
+    int32 jasync_parallel_run(jutils::jasync_task_queue_base& queue, const int64 begin, const int64 end, const int64 grainSize, Body& body)
+    {
+        jasync_parallel_context<Body> context;
+        context.queue = &queue;
+        context.body = &body;
+        context.grainSize = grainSize;
+        context.maxTasksCount = jasync_parallel_max_tasks_count(end - begin, grainSize);
+        context.tasks = jutils::memory::allocate<jasync_parallel_range_task<Body>>(context.maxTasksCount);
+        if (context.tasks == nullptr)
+        {
+            body(0, begin, end);
+            return 1;
+        }
+        context.tasksCount = 1;
+
+        jutils::memory::construct(context.tasks, &context, 0, begin, end);
+        context.tasks[0].run();
+        queue.wait(context.counter);
+
+        const int32 tasksCount = context.tasksCount.load(std::memory_order_relaxed);
+        for (int32 index = 0; index < tasksCount; index++)
+        {
+            jutils::memory::destruct(context.tasks + index);
+        }
+        jutils::memory::deallocate(context.tasks, context.maxTasksCount);
+        return tasksCount;
+    }
+}
+
+namespace jutils
+{
+    // Calls function(index) or function(chunkBegin, chunkEnd) for the range [begin, end). grainSize <= 0 picks it from the worker count,
+    // too small grainSize is raised so there are at most 64 chunks per worker
+    template<typename Func>
+    void parallel_for(jasync_task_queue_base& queue, const int64 begin, const int64 end, const int64 grainSize, Func&& function)
+    {
+        auto chunkFunction = [&function](int32, const int64 chunkBegin, const int64 chunkEnd)
+        {
+            if constexpr (std::is_invocable_v<Func&, int64, int64>)
+            {
+                function(chunkBegin, chunkEnd);
+            }
+            else
+            {
+                for (int64 index = chunkBegin; index < chunkEnd; index++)
+                {
+                    function(index);
+                }
+            }
+        };
+        if (begin >= end)
+        {
+            return;
+        }
+        if (!queue.isValid())
+        {
+            chunkFunction(0, begin, end);
+            return;
+        }
+        jutils_private::jasync_parallel_run(queue, begin, end, jutils_private::jasync_parallel_grain_size(queue, end - begin, grainSize), chunkFunction);
+    }
+
+    // function(chunkBegin, chunkEnd, value) -> T accumulates a chunk, reduce(T, T) -> T joins chunk results in the range order
+    template<typename T, typename Func, typename ReduceFunc>
+    [[nodiscard]] T parallel_reduce(jasync_task_queue_base& queue, const int64 begin, const int64 end, const int64 grainSize,
+        const T& identity, Func&& function, ReduceFunc&& reduce)
+    {
+        if (begin >= end)
+        {
+            return identity;
+        }
+        if (!queue.isValid())
+        {
+            return function(begin, end, identity);
+        }
+
+        struct chunk_result
+        {
+            int64 begin = 0;
+            T value;
+        };
+        std::vector<chunk_result> results;
+        auto chunkFunction = [&](const int32 taskIndex, const int64 chunkBegin, const int64 chunkEnd)
+        {
+            results[taskIndex] = { chunkBegin, function(chunkBegin, chunkEnd, identity) };
+        };
+
+        const int64 realGrainSize = jutils_private::jasync_parallel_grain_size(queue, end - begin, grainSize);
+        results.resize(jutils_private::jasync_parallel_max_tasks_count(end - begin, realGrainSize), { 0, identity });
+        results.resize(jutils_private::jasync_parallel_run(queue, begin, end, realGrainSize, chunkFunction), { 0, identity });
+        std::sort(results.begin(), results.end(), [](const chunk_result& result1, const chunk_result& result2) { return result1.begin < result2.begin; });
+        T result = identity;
+        for (auto& chunk : results)
+        {
+            result = reduce(std::move(result), std::move(chunk.value));
+        }
+        return result;
+    }
+}
@@ -0,0 +1,194 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jasync_task_queue.h"
+
+#include <deque>
+
+namespace jutils
+{
+    // Set of tasks with dependencies, the same graph can be run many times without allocations
+    class jasync_task_graph
+    {
+    public:
+
+        using node_id = int32;
+        static constexpr node_id invalid_node_id = -1;
+
+        jasync_task_graph() = default;
+        jasync_task_graph(const jasync_task_graph&) = delete;
+        jasync_task_graph(jasync_task_graph&&) noexcept = delete;
+        ~jasync_task_graph() { clear(); }
+
+        jasync_task_graph& operator=(const jasync_task_graph&) = delete;
+        jasync_task_graph& operator=(jasync_task_graph&&) noexcept = delete;
+
+        [[nodiscard]] int32 getNodesCount() const { return static_cast<int32>(nodes.size()); }
+        [[nodiscard]] bool isRunning() const { return !graphCounter.isDone(); }
+
+        // Graph takes ownership of tasks that should be deleted after execution and deletes them in clear().
+        // Task with a cancelled token is skipped, but its successors still run
+        inline node_id addNode(jasync_task* task);
+        inline bool addDependency(node_id predecessor, node_id successor);
+        inline void clear();
+
+        // Returns false if the graph is still running, has a cycle or the queue is not initialized
+        inline bool run(jasync_task_queue_base& queue);
+        inline void wait(jasync_task_queue_base& queue) const { queue.wait(graphCounter); }
+
+    private:
+
+        class node_task final : public jasync_task
+        {
+        public:
+            node_task(jasync_task_graph* graph, const node_id id) : ownerGraph(graph), nodeID(id) {}
+
+            virtual void run() override { ownerGraph->_runNode(nodeID); }
+            [[nodiscard]] virtual bool shouldDeleteAfterExecution() const override { return false; }
+
+        private:
+
+            jasync_task_graph* ownerGraph = nullptr;
+            node_id nodeID = invalid_node_id;
+        };
+        struct node
+        {
+            node(jasync_task_graph* graph, const node_id id, jasync_task* userTask) : nodeTask(graph, id), task(userTask) {}
+
+            node_task nodeTask;
+            jasync_task* task = nullptr;
+            std::vector<node_id> successors;
+            int32 predecessorsCount = 0;
+            std::atomic<int32> pendingPredecessors = 0;
+        };
+
+        std::deque<node> nodes;
+        std::vector<jasync_task*> rootTasks;
+        bool rootTasksDirty = false;
+
+        jasync_task_queue_base* runQueue = nullptr;
+        jasync_task_counter graphCounter;
+
+
+        inline bool _updateRootTasks();
+        inline void _runNode(node_id nodeID);
+    };
+
+    inline jasync_task_graph::node_id jasync_task_graph::addNode(jasync_task* task)
+    {
+        if ((task == nullptr) || isRunning())
+        {
+            return invalid_node_id;
+        }
+
+        const node_id nodeID = getNodesCount();
+        nodes.emplace_back(this, nodeID, task);
+        rootTasksDirty = true;
+        return nodeID;
+    }
+    inline bool jasync_task_graph::addDependency(const node_id predecessor, const node_id successor)
+    {
+        const node_id nodesCount = getNodesCount();
+        if ((predecessor < 0) || (predecessor >= nodesCount) || (successor < 0) || (successor >= nodesCount)
+            || (predecessor == successor) || isRunning())
+        {
+            return false;
+        }
+
+        nodes[predecessor].successors.push_back(successor);
+        nodes[successor].predecessorsCount++;
+        rootTasksDirty = true;
+        return true;
+    }
+    inline void jasync_task_graph::clear()
+    {
+        if ((runQueue != nullptr) && isRunning())
+        {
+            runQueue->wait(graphCounter);
+        }
+        for (const auto& graphNode : nodes)
+        {
+            if (graphNode.task->shouldDeleteAfterExecution())
+            {
+                delete graphNode.task;
+            }
+        }
+        nodes.clear();
+        rootTasks.clear();
+        rootTasksDirty = false;
+        runQueue = nullptr;
+    }
+
+    inline bool jasync_task_graph::run(jasync_task_queue_base& queue)
+    {
+        if (!queue.isValid() || isRunning() || !_updateRootTasks())
+        {
+            return false;
+        }
+
+        runQueue = &queue;
+        for (auto& graphNode : nodes)
+        {
+            graphNode.pendingPredecessors.store(graphNode.predecessorsCount, std::memory_order_relaxed);
+        }
+        queue.addTasks(rootTasks, &graphCounter);
+        return true;
+    }
+
+    inline bool jasync_task_graph::_updateRootTasks()
+    {
+        if (!rootTasksDirty)
+        {
+            return true;
+        }
+
+        // Kahn's algorithm, reject graphs where some nodes could never be released
+        std::vector<int32> predecessorsCount(nodes.size());
+        std::vector<node_id> readyNodes;
+        rootTasks.clear();
+        for (node_id nodeID = 0; nodeID < getNodesCount(); nodeID++)
+        {
+            predecessorsCount[nodeID] = nodes[nodeID].predecessorsCount;
+            if (predecessorsCount[nodeID] == 0)
+            {
+                readyNodes.push_back(nodeID);
+                rootTasks.push_back(&nodes[nodeID].nodeTask);
+            }
+        }
+        for (std::size_t index = 0; index < readyNodes.size(); index++)
+        {
+            for (const node_id successor : nodes[readyNodes[index]].successors)
+            {
+                if (--predecessorsCount[successor] == 0)
+                {
+                    readyNodes.push_back(successor);
+                }
+            }
+        }
+        if (readyNodes.size() != nodes.size())
+        {
+            rootTasks.clear();
+            return false;
+        }
+
+        rootTasksDirty = false;
+        return true;
+    }
+    inline void jasync_task_graph::_runNode(const node_id nodeID)
+    {
+        node& graphNode = nodes[nodeID];
+        if (!graphNode.task->isCancelled())
+        {
+            graphNode.task->run();
+        }
+        for (const node_id successor : graphNode.successors)
+        {
+            node& successorNode = nodes[successor];
+            if (successorNode.pendingPredecessors.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                runQueue->addTask(&successorNode.nodeTask, &graphCounter);
+            }
+        }
+    }
+}
@@ -3,26 +3,219 @@
 #pragma once
 
 #include "jmemory.h"
+#include "jmpmc_ring.h"
+#include "jthread.h"
+#include "jtimer_wheel.h"
+#include "jwork_stealing_deque.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <limits>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
-#include <list>
+
+#ifndef JUTILS_ASYNC_TASK_QUEUE_STATS
+    // Per-worker counters and latency histograms, see jasync_task_queue_base::getStats()
+    #define JUTILS_ASYNC_TASK_QUEUE_STATS 0
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+namespace jutils_private
+{
+    inline void jasync_cpu_relax()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+}
+
+namespace jutils
+{
+    constexpr int32 jasync_latency_buckets_count = 32;
+
+    struct jasync_worker_stats
+    {
+        uint64 executedTasks = 0;
+        uint64 busyTimeNs = 0;
+        uint64 idleTimeNs = 0;
+        uint64 stolenTasks = 0;
+        // Tasks skipped because their cancellation token was cancelled
+        uint64 cancelledTasks = 0;
+        // Bucket N counts tasks that waited in the queue for [2^N, 2^(N+1)) ns, the last one also counts everything longer
+        uint64 latencyHistogram[jasync_latency_buckets_count] = {};
+    };
+    struct jasync_task_queue_stats
+    {
+        // Queue sizes are approximate, nothing is locked while reading them
+        int64 queuedTasks = 0;
+        int32 parkedThreads = 0;
+        // Counters are filled only with JUTILS_ASYNC_TASK_QUEUE_STATS
+        std::vector<jasync_worker_stats> workers;
+        // Tasks executed by non-worker threads in wait()
+        jasync_worker_stats externalThreads;
+    };
+}
+
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+namespace jutils_private
+{
+    using jutils::int64;
+    using jutils::uint64;
+
+    [[nodiscard]] inline int64 jasync_stats_time()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Worker counters have the only writer, so they are updated without RMW operations
+    struct alignas(jutils::memory::cache_line_size) jasync_worker_stats_data
+    {
+        std::atomic<uint64> executedTasks = 0;
+        std::atomic<uint64> busyTimeNs = 0;
+        std::atomic<uint64> idleTimeNs = 0;
+        std::atomic<uint64> stolenTasks = 0;
+        std::atomic<uint64> cancelledTasks = 0;
+        std::atomic<uint64> latencyHistogram[jutils::jasync_latency_buckets_count] = {};
+
+        static void add(std::atomic<uint64>& counter, const uint64 value, const bool shared)
+        {
+            if (shared)
+            {
+                counter.fetch_add(value, std::memory_order_relaxed);
+            }
+            else
+            {
+                counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+        }
+        void addLatency(const int64 latency, const bool shared)
+        {
+            int32 bucket = 0;
+            for (uint64 value = static_cast<uint64>(latency > 0 ? latency : 1); (value > 1) && (bucket < (jutils::jasync_latency_buckets_count - 1)); value >>= 1)
+            {
+                bucket++;
+            }
+            add(latencyHistogram[bucket], 1, shared);
+        }
+        void copyTo(jutils::jasync_worker_stats& outStats) const
+        {
+            outStats.executedTasks = executedTasks.load(std::memory_order_relaxed);
+            outStats.busyTimeNs = busyTimeNs.load(std::memory_order_relaxed);
+            outStats.idleTimeNs = idleTimeNs.load(std::memory_order_relaxed);
+            outStats.stolenTasks = stolenTasks.load(std::memory_order_relaxed);
+            outStats.cancelledTasks = cancelledTasks.load(std::memory_order_relaxed);
+            for (int32 bucket = 0; bucket < jutils::jasync_latency_buckets_count; bucket++)
+            {
+                outStats.latencyHistogram[bucket] = latencyHistogram[bucket].load(std::memory_order_relaxed);
+            }
+        }
+    };
+}
+#endif
 
 namespace jutils
 {
+    class jasync_task_queue_base;
+
+    enum class jasync_task_priority : uint8
+    {
+        high,
+        normal,
+        background
+    };
+    constexpr int32 jasync_task_priority_count = 3;
+
+    class jasync_task_counter
+    {
+        friend jasync_task_queue_base;
+
+    public:
+        jasync_task_counter() = default;
+        jasync_task_counter(const jasync_task_counter&) = delete;
+        jasync_task_counter(jasync_task_counter&&) noexcept = delete;
+        ~jasync_task_counter() = default;
+
+        jasync_task_counter& operator=(const jasync_task_counter&) = delete;
+        jasync_task_counter& operator=(jasync_task_counter&&) noexcept = delete;
+
+        [[nodiscard]] int32 getPendingCount() const { return pendingTasks.load(std::memory_order_acquire); }
+        [[nodiscard]] bool isDone() const { return getPendingCount() == 0; }
+
+    private:
+
+        std::atomic<int32> pendingTasks = 0;
+    };
+
+    // Shared by a group of tasks: queued tasks of a cancelled group are skipped without run(), running tasks could poll isCancelled().
+    // Skipped tasks are released as usual, so counters and waitForIdle() still see them finished. Token must outlive its tasks
+    class jasync_cancellation_token
+    {
+    public:
+        jasync_cancellation_token() = default;
+        jasync_cancellation_token(const jasync_cancellation_token&) = delete;
+        jasync_cancellation_token(jasync_cancellation_token&&) noexcept = delete;
+        ~jasync_cancellation_token() = default;
+
+        jasync_cancellation_token& operator=(const jasync_cancellation_token&) = delete;
+        jasync_cancellation_token& operator=(jasync_cancellation_token&&) noexcept = delete;
+
+        [[nodiscard]] bool isCancelled() const { return cancelled.load(std::memory_order_acquire); }
+        void cancel() { cancelled.store(true, std::memory_order_release); }
+        // Tasks that are still queued are not skipped anymore
+        void reset() { cancelled.store(false, std::memory_order_release); }
+
+    private:
+
+        std::atomic_bool cancelled = false;
+    };
+
     class jasync_task
     {
+        friend jasync_task_queue_base;
+
     protected:
         jasync_task() = default;
     public:
         virtual ~jasync_task() = default;
 
         virtual void run() = 0;
+        // Checked before run(), tasks that are not deleted by the queue are not touched after run()
         [[nodiscard]] virtual bool shouldDeleteAfterExecution() const { return true; }
+
+        // Should be set before the task is queued
+        void setCancellationToken(const jasync_cancellation_token* token) { cancellationToken = token; }
+        [[nodiscard]] const jasync_cancellation_token* getCancellationToken() const { return cancellationToken; }
+        [[nodiscard]] bool isCancelled() const { return (cancellationToken != nullptr) && cancellationToken->isCancelled(); }
+
+    private:
+
+        jasync_task_counter* taskCounter = nullptr;
+        const jasync_cancellation_token* cancellationToken = nullptr;
+        // Link in the overflow list of a lane, so queuing a task never allocates
+        jasync_task* nextTask = nullptr;
+        jasync_task_priority taskPriority = jasync_task_priority::normal;
+        bool inlineTask = false;
+        // Valid for periodic tasks, they are scheduled again after run()
+        jtimer_handle timerHandle;
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        int64 enqueueTime = 0;
+#endif
     };
     class jasync_task_default : public jasync_task
     {
@@ -44,6 +237,126 @@ namespace jutils
 
         std::function<void()> taskFunction = nullptr;
     };
+    // Heap task for any callable, unlike jasync_task_default it accepts move-only callables
+    template<typename Func>
+    class jasync_task_function final : public jasync_task
+    {
+    public:
+        template<typename F>
+        explicit jasync_task_function(F&& func) : taskFunction(std::forward<F>(func)) {}
+        virtual ~jasync_task_function() override = default;
+
+        virtual void run() override { taskFunction(); }
+
+    private:
+
+        Func taskFunction;
+    };
+
+    constexpr std::size_t jasync_task_inline_size = 64;
+
+    // Queue-owned slot, the callable is stored inside the slot and the slot is recycled after execution
+    class alignas(memory::cache_line_size) jasync_task_inline final : public jasync_task
+    {
+        friend jasync_task_queue_base;
+
+    public:
+        jasync_task_inline() = default;
+        jasync_task_inline(const jasync_task_inline&) = delete;
+        jasync_task_inline(jasync_task_inline&&) noexcept = delete;
+        virtual ~jasync_task_inline() override { _resetFunction(); }
+
+        jasync_task_inline& operator=(const jasync_task_inline&) = delete;
+        jasync_task_inline& operator=(jasync_task_inline&&) noexcept = delete;
+
+        template<typename Func>
+        static constexpr bool can_store = (sizeof(std::decay_t<Func>) <= jasync_task_inline_size)
+            && (alignof(std::decay_t<Func>) <= alignof(std::max_align_t));
+
+        virtual void run() override
+        {
+            if (invokeFunction != nullptr)
+            {
+                invokeFunction(storage);
+            }
+        }
+        [[nodiscard]] virtual bool shouldDeleteAfterExecution() const override { return false; }
+
+    private:
+
+        alignas(std::max_align_t) uint8 storage[jasync_task_inline_size];
+        void (*invokeFunction)(void*) = nullptr;
+        void (*destroyFunction)(void*) = nullptr;
+
+
+        template<typename Func>
+        void _setFunction(Func&& function);
+        void _resetFunction()
+        {
+            if (destroyFunction != nullptr)
+            {
+                destroyFunction(storage);
+            }
+            invokeFunction = nullptr;
+            destroyFunction = nullptr;
+        }
+    };
+
+    enum class jasync_task_queue_mode : uint8
+    {
+        // All workers pull tasks from one queue guarded by a mutex
+        shared_queue,
+        // Each worker owns a deque (LIFO for the owner, FIFO for thieves), the shared queue only receives tasks from non-worker threads
+        work_stealing
+    };
+    enum class jasync_task_queue_backend : uint8
+    {
+        // Shared queue is an intrusive list guarded by a mutex
+        locked_list,
+        // Shared queue is a preallocated lock-free ring, the locked list is used only when the ring is full
+        lock_free_ring
+    };
+    enum class jasync_worker_affinity : uint8
+    {
+        // Threads are not pinned
+        none,
+        // Each worker is pinned to its own CPU
+        cpu,
+        // Workers are split between NUMA nodes and pinned to all CPUs of their node, thieves prefer victims from the same node
+        numa_node
+    };
+    struct jasync_task_queue_settings
+    {
+        int32 workerCount = 0;
+        jasync_task_queue_mode mode = jasync_task_queue_mode::shared_queue;
+        jasync_task_queue_backend backend = jasync_task_queue_backend::locked_list;
+        // Capacity of the ring of each priority lane
+        int32 ringCapacity = 4096;
+        // Every Nth pick a worker checks lower priority lanes first, so they can't be starved by higher priority tasks (0 - never)
+        int32 lowPriorityPickInterval = 16;
+        // Count of queue-owned slots for callables passed to addTask(), callables are allocated on the heap when there is no free slot
+        int32 inlineTaskCount = 1024;
+        // Idle worker polls the queues spinCount times, then yields yieldCount times and only then falls asleep
+        int32 spinCount = 64;
+        int32 yieldCount = 8;
+        // Workers above workerCount are constructed in init() but started only by setWorkerCount() or updateWorkerCount()
+        int32 maxWorkerCount = 0;
+        // updateWorkerCount() starts a worker when there are more than scaleUpQueueDepth queued tasks per worker,
+        // and stops one after scaleDownUpdates calls in a row with empty queue and sleeping workers
+        int32 minWorkerCount = 1;
+        int32 scaleUpQueueDepth = 4;
+        int32 scaleDownUpdates = 8;
+        // Worker threads are named "<name> <index>" (Linux cuts names to 15 characters), empty - threads are not named
+        std::string threadName;
+        jasync_worker_affinity affinity = jasync_worker_affinity::none;
+        // CPUs used for pinning, empty - all CPUs available to the process
+        std::vector<int32> affinityCpus;
+        // Tick of the timer wheel, delays are rounded up to it
+        std::chrono::nanoseconds timerResolution = std::chrono::milliseconds(1);
+    };
+
+    class jasync_worker;
+    class jasync_schedule_awaiter;
 
     class jasync_task_queue_base
     {
@@ -51,44 +364,283 @@ namespace jutils
         jasync_task_queue_base() = default;
     public:
 
-        [[nodiscard]] bool isValid() const { return asyncWorkerCount != 0; }
+        [[nodiscard]] bool isValid() const { return workersCapacity != 0; }
+        [[nodiscard]] int32 getWorkerCount() const { return asyncWorkerCount.load(std::memory_order_relaxed); }
+        [[nodiscard]] int32 getMaxWorkerCount() const { return workersCapacity; }
+        [[nodiscard]] jasync_task_queue_mode getMode() const { return queueMode; }
+
+        inline bool addTask(jasync_task* task, jasync_task_counter* counter = nullptr)
+            { return addTask(task, jasync_task_priority::normal, counter); }
+        inline bool addTask(jasync_task* task, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        inline void addTasks(const std::vector<jasync_task*>& tasks, jasync_task_counter* counter = nullptr)
+            { addTasks(tasks.data(), tasks.size(), jasync_task_priority::normal, counter); }
+        inline void addTasks(const std::vector<jasync_task*>& tasks, const jasync_task_priority priority, jasync_task_counter* counter = nullptr)
+            { addTasks(tasks.data(), tasks.size(), priority, counter); }
+        inline void addTasks(std::initializer_list<jasync_task*> tasks, jasync_task_counter* counter = nullptr)
+            { addTasks(std::data(tasks), tasks.size(), jasync_task_priority::normal, counter); }
+        inline void addTasks(std::initializer_list<jasync_task*> tasks, const jasync_task_priority priority, jasync_task_counter* counter = nullptr)
+            { addTasks(std::data(tasks), tasks.size(), priority, counter); }
+        // Tasks are stored in the caller's array, so the batch is queued without an array of pointers.
+        // The queue never deletes them, shouldDeleteAfterExecution() has to return false
+        template<typename TaskType> requires std::is_base_of_v<jasync_task, TaskType>
+        void addTasks(TaskType* tasks, const std::size_t tasksCount, jasync_task_counter* counter = nullptr)
+            { addTasks(tasks, tasksCount, jasync_task_priority::normal, counter); }
+        template<typename TaskType> requires std::is_base_of_v<jasync_task, TaskType>
+        void addTasks(TaskType* tasks, const std::size_t tasksCount, const jasync_task_priority priority, jasync_task_counter* counter = nullptr)
+            { _addTasks(tasksCount, [tasks](const std::size_t index) -> jasync_task* { return tasks + index; }, priority, counter); }
 
-        inline bool addTask(jasync_task* task);
-        inline void addTasks(const std::vector<jasync_task*>& tasks) { addTasks(tasks.data(), tasks.size()); }
-        inline void addTasks(std::initializer_list<jasync_task*> tasks) { addTasks(std::data(tasks), tasks.size()); }
+        // Stores the callable in a free queue-owned slot if it fits, so steady-state submission doesn't allocate
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addTask(Func&& function, jasync_task_counter* counter = nullptr)
+            { return addTask(std::forward<Func>(function), jasync_task_priority::normal, counter); }
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addTask(Func&& function, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        // Callable is skipped if the token is cancelled before it's started
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addTask(Func&& function, const jasync_cancellation_token& token, jasync_task_counter* counter = nullptr)
+            { return addTask(std::forward<Func>(function), token, jasync_task_priority::normal, counter); }
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addTask(Func&& function, const jasync_cancellation_token& token, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
         inline void clearTasks();
 
+        // Task is executed only by the worker with this index while it's running. Tasks of a worker that is not started
+        // or is removed by setWorkerCount() are moved to the shared queue
+        inline bool addTaskToWorker(int32 workerIndex, jasync_task* task, jasync_task_counter* counter = nullptr);
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addTaskToWorker(int32 workerIndex, Func&& function, jasync_task_counter* counter = nullptr);
+        // Task is executed only on the thread that called init(): by pump() or while this thread is in wait() or waitForIdle()
+        inline bool addPumpTask(jasync_task* task, jasync_task_counter* counter = nullptr);
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        bool addPumpTask(Func&& function, jasync_task_counter* counter = nullptr);
+        // Executes up to budget tasks of the pump queue, returns count of executed tasks. Does nothing on other threads
+        inline int32 pump(int32 budget = std::numeric_limits<int32>::max());
+        [[nodiscard]] bool isPumpThread() const { return isValid() && (std::this_thread::get_id() == pumpThreadID); }
+
+        // Task is queued after the delay by one of idle workers. Counter is pending until the task is finished or the timer is cancelled
+        jtimer_handle addDelayedTask(jasync_task* task, const std::chrono::nanoseconds delay, jasync_task_counter* counter = nullptr)
+            { return addDelayedTask(task, delay, jasync_task_priority::normal, counter); }
+        inline jtimer_handle addDelayedTask(jasync_task* task, std::chrono::nanoseconds delay, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        jtimer_handle addDelayedTask(Func&& function, const std::chrono::nanoseconds delay, jasync_task_counter* counter = nullptr)
+            { return addDelayedTask(std::forward<Func>(function), delay, jasync_task_priority::normal, counter); }
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        jtimer_handle addDelayedTask(Func&& function, std::chrono::nanoseconds delay, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        // Task is queued every period until the timer is cancelled, runs never overlap and missed periods are skipped.
+        // Task is deleted (if it should be) and the counter is released only when the timer or the task's cancellation token is cancelled
+        jtimer_handle addPeriodicTask(jasync_task* task, const std::chrono::nanoseconds period, jasync_task_counter* counter = nullptr)
+            { return addPeriodicTask(task, period, jasync_task_priority::normal, counter); }
+        inline jtimer_handle addPeriodicTask(jasync_task* task, std::chrono::nanoseconds period, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        jtimer_handle addPeriodicTask(Func&& function, const std::chrono::nanoseconds period, jasync_task_counter* counter = nullptr)
+            { return addPeriodicTask(std::forward<Func>(function), period, jasync_task_priority::normal, counter); }
+        template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+        jtimer_handle addPeriodicTask(Func&& function, std::chrono::nanoseconds period, jasync_task_priority priority, jasync_task_counter* counter = nullptr);
+        // Returns false if the timer is already fired or cancelled. Running periodic task is finished, but not scheduled again
+        inline bool cancelTimer(const jtimer_handle& handle);
+        [[nodiscard]] int32 getTimersCount() const { return timersCount.load(std::memory_order_relaxed); }
+
+        // Executes queued tasks on the calling thread until all tasks of the counter are finished
+        inline void wait(const jasync_task_counter& counter);
+
+        // Could be polled while workers are running, vector of workers is reused
+        inline void getStats(jasync_task_queue_stats& outStats) const;
+
+        // Doesn't block, workers exit after their current task or, with drain, once nothing is queued or running.
+        // New tasks are still accepted, threads are joined and tasks left without drain are dropped in stop()
+        inline void requestStop(bool drain = true);
+        [[nodiscard]] bool isStopRequested() const { return stopRequested.load(std::memory_order_acquire); }
+        // Executes queued tasks on the calling thread until nothing is queued or running, returns false on timeout. Can't be called from tasks
+        inline bool waitForIdle(std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+
+        // Keeps the counter pending for work that is not a queued task, each retainCounter() needs one releaseCounter()
+        inline void retainCounter(jasync_task_counter& counter) { counter.pendingTasks.fetch_add(1, std::memory_order_relaxed); }
+        inline void releaseCounter(jasync_task_counter& counter);
+
+        // Awaiter that resumes the coroutine on a worker, defined in jasync_coroutine.h
+        inline jasync_schedule_awaiter schedule(jasync_task_priority priority = jasync_task_priority::normal);
+
     protected:
 
         struct task_description
         {
             jasync_task* task = nullptr;
+            jasync_task_counter* counter = nullptr;
+            bool inlineTask = false;
+            bool deleteTask = false;
+            jtimer_handle timerHandle;
 
-            void clear() const
-            {
-                if (task->shouldDeleteAfterExecution())
-                {
-                    delete task;
-                }
-            }
+            explicit task_description(jasync_task* queuedTask)
+                : task(queuedTask), counter(queuedTask->taskCounter), inlineTask(queuedTask->inlineTask)
+                , deleteTask(!queuedTask->inlineTask && queuedTask->shouldDeleteAfterExecution()), timerHandle(queuedTask->timerHandle)
+            {}
+        };
+        struct timer_record
+        {
+            jasync_task* task = nullptr;
+            jasync_task_counter* counter = nullptr;
+            jasync_task_priority priority = jasync_task_priority::normal;
+            // 0 for delayed tasks
+            int64 periodTicks = 0;
+            bool cancelled = false;
+        };
+        using timer_wheel_type = jtimer_wheel<timer_record>;
+        static constexpr int32 all_workers = std::numeric_limits<int32>::max();
+        // Busy workers check timers after this count of executed tasks
+        static constexpr int32 timers_check_interval = 64;
+
+        struct task_lane
+        {
+            jmpmc_ring<jasync_task*> tasksRing;
+            std::mutex tasksQueueMutex;
+            jasync_task* tasksQueueHead = nullptr;
+            jasync_task* tasksQueueTail = nullptr;
+            std::atomic<std::size_t> tasksQueueSize = 0;
+
+            [[nodiscard]] std::size_t getSize() const { return static_cast<std::size_t>(tasksRing.getSize()) + tasksQueueSize.load(std::memory_order_relaxed); }
+
+            void push(jasync_task* const* tasks, const std::size_t tasksCount)
+                { push(tasksCount, [tasks](const std::size_t index) { return tasks[index]; }); }
+            template<typename TaskGetter>
+            void push(std::size_t tasksCount, TaskGetter getTask);
+            [[nodiscard]] inline jasync_task* pop();
         };
 
-        std::mutex tasksQueueMutex;
-        std::condition_variable taskAvailableCondition;
-        std::list<task_description> tasksQueue;
+        task_lane taskLanes[jasync_task_priority_count];
+        int32 lowPriorityPickInterval = 0;
+        int32 spinCount = 0;
+        int32 yieldCount = 0;
+        alignas(memory::cache_line_size) std::atomic<uint32> wakeEpoch = 0;
+        // Threads sleeping on wakeEpoch, producers don't touch the epoch while it's 0
+        alignas(memory::cache_line_size) std::atomic<int32> parkedThreadsCount = 0;
+        // Parked threads that execute the lane. Lane counters are incremented before parkedThreadsCount and decremented after it
+        std::atomic<int32> parkedLaneThreadsCount[jasync_task_priority_count] = {};
+        std::atomic<int32> counterWaitersCount = 0;
+
+        std::atomic_bool stopRequested = false;
+        std::atomic_bool drainOnStop = false;
+        // Tasks are counted by the thread that submits or finishes them, threads outside of the queue share these counters
+        alignas(memory::cache_line_size) std::atomic<uint64> externalSubmittedTasks = 0;
+        std::atomic<uint64> externalFinishedTasks = 0;
+
+        // Timers are serviced by one idle worker at a time (timer keeper), it sleeps until the next timer instead of parking
+        std::mutex timersMutex;
+        timer_wheel_type timerWheel;
+        std::chrono::steady_clock::time_point timersStartTime;
+        int64 timerResolutionNs = 1000000;
+        alignas(memory::cache_line_size) std::atomic<int32> timersCount = 0;
+        std::atomic<int64> nextTimerTick = timer_wheel_type::invalid_tick;
+        std::atomic_bool timerKeeperActive = false;
+        std::atomic_bool timerKeeperParked = false;
+        std::mutex timerKeeperMutex;
+        std::condition_variable timerKeeperCondition;
+
+        // Private queues of workers and the pump queue, tasks from them are never stolen
+        task_lane* workerLanes = nullptr;
+        task_lane pumpLane;
+        std::thread::id pumpThreadID;
+
+        jasync_task_inline* inlineTasks = nullptr;
+        int32 inlineTasksCount = 0;
+        jmpmc_ring<jasync_task_inline*> freeInlineTasks;
+
+        jasync_worker** baseWorkers = nullptr;
+        // Workers [0, asyncWorkerCount) are running, the rest of constructed ones are stopped
+        std::atomic<int32> asyncWorkerCount = 0;
+        int32 workersCapacity = 0;
+        int32 minWorkerCount = 1;
+        int32 scaleUpQueueDepth = 0;
+        int32 scaleDownUpdates = 0;
+        int32 idleUpdatesCount = 0;
+        int32 numaNodesCount = 1;
+        std::string workerThreadName;
+        jasync_task_queue_mode queueMode = jasync_task_queue_mode::shared_queue;
+
+        inline static thread_local jasync_worker* CurrentWorker = nullptr;
+
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        jutils_private::jasync_worker_stats_data externalStats;
+#endif
+
+
+        inline void addTasks(jasync_task* const* tasks, std::size_t tasksCount, jasync_task_priority priority, jasync_task_counter* counter)
+            { _addTasks(tasksCount, [tasks](const std::size_t index) { return tasks[index]; }, priority, counter); }
+        template<typename TaskGetter>
+        void _addTasks(std::size_t tasksCount, TaskGetter getTask, jasync_task_priority priority, jasync_task_counter* counter);
+
+        inline void _createInlineTasks(int32 count);
+        inline void _destroyInlineTasks();
+        inline void _createWorkerLanes(int32 count);
+        inline void _destroyWorkerLanes();
+        inline void _addPrivateTask(task_lane& lane, jasync_task* task, jasync_task_counter* counter);
+        [[nodiscard]] inline task_lane* _getPrivateLane(const jasync_worker* worker);
+        [[nodiscard]] bool _hasPrivateTasks(const jasync_worker* worker)
+        {
+            const task_lane* lane = _getPrivateLane(worker);
+            return (lane != nullptr) && (lane->getSize() > 0);
+        }
+        template<typename Func>
+        [[nodiscard]] jasync_task* _createFunctionTask(Func&& function);
+
+        [[nodiscard]] inline jasync_worker* _getCurrentWorker() const;
+        [[nodiscard]] task_lane& _getLane(const jasync_task_priority priority) { return taskLanes[static_cast<uint8>(priority)]; }
+        [[nodiscard]] inline bool _canExecuteAllLanes(int32 workerCount) const;
+        inline void _placeWorkers(const jasync_task_queue_settings& settings);
+        inline void _setupWorkerThread(const jasync_worker* worker) const;
+
+        [[nodiscard]] inline jasync_task* _pullTask(jasync_worker* worker);
+        [[nodiscard]] inline jasync_task* _pullLaneTask(jasync_worker* worker, jasync_task_priority priority);
+        [[nodiscard]] inline jasync_task* _stealTask(jasync_worker* thief);
+        [[nodiscard]] inline bool _hasQueuedTasks(const jasync_worker* worker);
+        [[nodiscard]] inline int64 _getQueuedTasksCount() const;
+        inline void _clearQueuedTasks();
+        inline void _clearLane(task_lane& lane, jasync_worker* worker);
+        inline void _moveLocalTasks(jasync_worker* worker);
+        inline void _moveWorkerLane(int32 workerIndex);
+
+        inline void _countSubmittedTasks(jasync_worker* worker, uint64 tasksCount);
+        [[nodiscard]] inline bool _isIdle() const;
+        [[nodiscard]] inline bool _shouldWorkerExit(const jasync_worker* worker) const;
 
-        int32 asyncWorkerCount = 0;
+        [[nodiscard]] inline int64 _getTimerTick() const;
+        inline jtimer_handle _addTimer(jasync_task* task, std::chrono::nanoseconds delay, int64 periodTicks, jasync_task_priority priority, jasync_task_counter* counter);
+        inline bool _serviceTimers();
+        [[nodiscard]] bool _needsTimerKeeper() const
+        {
+            return (timersCount.load(std::memory_order_relaxed) > 0) && !timerKeeperActive.load(std::memory_order_relaxed)
+                && !stopRequested.load(std::memory_order_relaxed);
+        }
+        [[nodiscard]] inline bool _claimTimerKeeper();
+        inline void _releaseTimerKeeper();
+        template<typename Predicate>
+        void _parkTimerKeeper(const jasync_worker* worker, Predicate canPark);
+        inline void _rescheduleTimer(const task_description& description);
+        inline void _releaseTimerTask(const timer_record& record);
+        inline void _clearTimers();
 
+        inline void _executeTask(jasync_task* task, jasync_worker* worker);
+        inline void _finishTask(jasync_task* task, jasync_worker* worker);
+        inline void _finishTask(const task_description& description, jasync_worker* worker);
+        inline void _releaseTask(const task_description& description);
 
-        inline void addTasks(jasync_task* const* tasks, std::size_t tasksCount);
+        template<typename Predicate>
+        void _idle(int32& idleIteration, const jasync_worker* worker, Predicate canPark);
+        inline void _countParkedThread(const jasync_worker* worker);
+        inline void _uncountParkedThread(const jasync_worker* worker);
+        // Wakes up to workersCount parked workers
+        inline void _notifyWorkers(int32 workersCount);
+        // Wakes up to workersCount parked workers that execute the lane
+        inline void _notifyLaneWorkers(int32 workersCount, jasync_task_priority priority);
+        inline void _wakeWorkers(int32 workersCount);
+        // Timer keeper has to recalculate its sleep time after a new earliest timer
+        inline void _wakeTimerKeeper();
     };
 
-    class jasync_worker;
     template<typename WorkerType = jasync_worker>
     class jasync_task_queue;
 
     class jasync_worker
     {
+        friend jasync_task_queue_base;
         template<typename T>
         friend class jasync_task_queue;
 
@@ -100,13 +652,34 @@ namespace jutils
         void onStop_WorkerThread() const {}
         void onStop_MainThread() const {}
 
+        // Called once in init(), lets dedicate workers to some of the lanes. Tasks spawned into the worker's own deque are always executed
+        bool canExecuteTasks(jasync_task_priority) const { return true; }
+
         [[nodiscard]] int32 getWorkerIndex() const { return workerIndex; }
+        [[nodiscard]] int32 getNumaNode() const { return numaNode; }
+        [[nodiscard]] const std::vector<int32>& getCpus() const { return cpus; }
 
     private:
 
         std::thread workerThread;
         int32 workerIndex = -1;
         std::atomic_bool shouldStop = false;
+
+        jasync_task_queue_base* ownerQueue = nullptr;
+        jwork_stealing_deque<jasync_task*> localTasks;
+        uint32 stealSeed = 0;
+        int32 numaNode = 0;
+        std::vector<int32> cpus;
+        uint32 pickCounter = 0;
+        bool allowedLanes[jasync_task_priority_count] = { true, true, true };
+
+        // Written only by the worker's thread
+        alignas(memory::cache_line_size) std::atomic<uint64> submittedTasks = 0;
+        std::atomic<uint64> finishedTasks = 0;
+
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        jutils_private::jasync_worker_stats_data stats;
+#endif
     };
 
     template<typename WorkerType>
@@ -126,171 +699,1558 @@ namespace jutils
 
         template<typename... Args>
         bool init(int32 workerCount, Args&&... args);
-        void stop();
-        
+        template<typename... Args>
+        bool init(const jasync_task_queue_settings& settings, Args&&... args);
+        // With drain queued tasks are executed first, but no longer than drainTimeout
+        void stop(bool drain = false, std::chrono::nanoseconds drainTimeout = std::chrono::nanoseconds::max());
+
+        // Starts or stops workers without dropping tasks, count is limited by settings.maxWorkerCount. Can't be called from the queue's workers
+        bool setWorkerCount(int32 workerCount);
+        // Auto scaling policy, call it periodically from the owner thread
+        void updateWorkerCount();
+
     private:
 
         worker_type* asyncWorkers = nullptr;
 
 
+        // Calls onStop_MainThread() for started workers and destroys all of them
+        void _destroyWorkers(int32 startedCount);
         void _workerThreadFunction(worker_type* worker);
     };
-    
-    inline bool jasync_task_queue_base::addTask(jasync_task* task)
+
+    template<typename Func>
+    void jasync_task_inline::_setFunction(Func&& function)
+    {
+        using function_type = std::decay_t<Func>;
+        memory::construct(static_cast<function_type*>(static_cast<void*>(storage)), std::forward<Func>(function));
+        invokeFunction = [](void* data) { (*std::launder(static_cast<function_type*>(data)))(); };
+        destroyFunction = [](void* data) { memory::destruct(std::launder(static_cast<function_type*>(data))); };
+    }
+
+    inline bool jasync_task_queue_base::addTask(jasync_task* task, const jasync_task_priority priority, jasync_task_counter* counter)
     {
-        if ((asyncWorkerCount == 0) || (task == nullptr))
+        if (!isValid() || (task == nullptr))
         {
             return false;
         }
 
-        tasksQueueMutex.lock();
-        tasksQueue.push_back({ task });
-        tasksQueueMutex.unlock();
+        task->taskCounter = counter;
+        task->taskPriority = priority;
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        task->enqueueTime = jutils_private::jasync_stats_time();
+#endif
+        if (counter != nullptr)
+        {
+            counter->pendingTasks.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        jasync_worker* worker = _getCurrentWorker();
+        _countSubmittedTasks(worker, 1);
+        if ((worker != nullptr) && (queueMode == jasync_task_queue_mode::work_stealing) && (priority == jasync_task_priority::normal))
+        {
+            worker->localTasks.push(task);
+        }
+        else
+        {
+            _getLane(priority).push(&task, 1);
+        }
 
-        taskAvailableCondition.notify_one();
+        _notifyLaneWorkers(1, priority);
         return true;
     }
-    inline void jasync_task_queue_base::addTasks(jasync_task* const* const tasks, const std::size_t tasksCount)
+    template<typename TaskGetter>
+    void jasync_task_queue_base::_addTasks(const std::size_t tasksCount, TaskGetter getTask, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
     {
-        if ((asyncWorkerCount == 0) || (tasksCount == 0))
+        if (!isValid() || (tasksCount == 0))
         {
             return;
         }
 
-        tasksQueueMutex.lock();
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        const int64 enqueueTime = jutils_private::jasync_stats_time();
+#endif
+        int32 countedTasks = 0;
         for (std::size_t index = 0; index < tasksCount; index++)
         {
-            tasksQueue.push_back({ tasks[index] });
+            jasync_task* task = getTask(index);
+            if (task != nullptr)
+            {
+                task->taskCounter = counter;
+                task->taskPriority = priority;
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+                task->enqueueTime = enqueueTime;
+#endif
+                countedTasks++;
+            }
+        }
+        if (counter != nullptr)
+        {
+            counter->pendingTasks.fetch_add(countedTasks, std::memory_order_relaxed);
+        }
+
+        jasync_worker* worker = _getCurrentWorker();
+        _countSubmittedTasks(worker, static_cast<uint64>(countedTasks));
+        if ((worker != nullptr) && (queueMode == jasync_task_queue_mode::work_stealing) && (priority == jasync_task_priority::normal))
+        {
+            for (std::size_t index = 0; index < tasksCount; index++)
+            {
+                jasync_task* task = getTask(index);
+                if (task != nullptr)
+                {
+                    worker->localTasks.push(task);
+                }
+            }
+        }
+        else
+        {
+            _getLane(priority).push(tasksCount, getTask);
         }
-        tasksQueueMutex.unlock();
 
-        taskAvailableCondition.notify_all();
+        _notifyLaneWorkers(countedTasks, priority);
     }
-    inline void jasync_task_queue_base::clearTasks()
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    bool jasync_task_queue_base::addTask(Func&& function, const jasync_task_priority priority, jasync_task_counter* counter)
     {
-        if (asyncWorkerCount == 0)
+        if (!isValid())
         {
-            return;
+            return false;
         }
-
-        std::lock_guard lock(tasksQueueMutex);
-        for (const auto& task : tasksQueue)
+        return addTask(_createFunctionTask(std::forward<Func>(function)), priority, counter);
+    }
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    bool jasync_task_queue_base::addTask(Func&& function, const jasync_cancellation_token& token, const jasync_task_priority priority, 
+        jasync_task_counter* counter)
+    {
+        if (!isValid())
         {
-            task.clear();
+            return false;
         }
-        tasksQueue.clear();
+        jasync_task* task = _createFunctionTask(std::forward<Func>(function));
+        task->setCancellationToken(&token);
+        return addTask(task, priority, counter);
     }
-
-    template<typename WorkerType>
-    template<typename... Args>
-    bool jasync_task_queue<WorkerType>::init(const int32 workerCount, Args&&... args)
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    jtimer_handle jasync_task_queue_base::addDelayedTask(Func&& function, const std::chrono::nanoseconds delay, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
+    {
+        if (!isValid())
+        {
+            return {};
+        }
+        return addDelayedTask(_createFunctionTask(std::forward<Func>(function)), delay, priority, counter);
+    }
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    jtimer_handle jasync_task_queue_base::addPeriodicTask(Func&& function, const std::chrono::nanoseconds period, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
+    {
+        if (!isValid())
+        {
+            return {};
+        }
+        return addPeriodicTask(_createFunctionTask(std::forward<Func>(function)), period, priority, counter);
+    }
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    bool jasync_task_queue_base::addTaskToWorker(const int32 workerIndex, Func&& function, jasync_task_counter* counter)
     {
-        if ((asyncWorkerCount != 0) || (workerCount <= 0))
+        if (!isValid() || (workerIndex < 0) || (workerIndex >= workersCapacity))
         {
             return false;
         }
-        
-        asyncWorkers = memory::allocate<worker_type>(workerCount);
-        asyncWorkerCount = workerCount;
-        for (int32 index = 0; index < workerCount; index++)
+        return addTaskToWorker(workerIndex, _createFunctionTask(std::forward<Func>(function)), counter);
+    }
+    template<typename Func> requires std::is_invocable_v<std::decay_t<Func>&>
+    bool jasync_task_queue_base::addPumpTask(Func&& function, jasync_task_counter* counter)
+    {
+        if (!isValid())
         {
-            memory::construct(asyncWorkers + index, std::forward<Args>(args)...);
-
-            asyncWorkers[index].workerIndex = index;
-            if (!asyncWorkers[index].onStart_MainThread())
-            {
-                memory::destruct(asyncWorkers + index);
-                for (int32 index1 = index - 1; index1 >= 0; index1--)
-                {
-                    asyncWorkers[index1].onStop_MainThread();
-                    memory::destruct(asyncWorkers + index1);
-                }
+            return false;
+        }
+        return addPumpTask(_createFunctionTask(std::forward<Func>(function)), counter);
+    }
+    inline bool jasync_task_queue_base::addTaskToWorker(const int32 workerIndex, jasync_task* task, jasync_task_counter* counter)
+    {
+        if (!isValid() || (task == nullptr) || (workerIndex < 0) || (workerIndex >= workersCapacity))
+        {
+            return false;
+        }
 
-                memory::deallocate(asyncWorkers, asyncWorkerCount);
-                asyncWorkers = nullptr;
-                asyncWorkerCount = 0;
-                return false;
-            }
+        _addPrivateTask(workerLanes[workerIndex], task, counter);
+        // Pairs with the fence in setWorkerCount(): either the worker is seen removed here or its lane is moved after the task is pushed
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (workerIndex >= asyncWorkerCount.load(std::memory_order_relaxed))
+        {
+            _moveWorkerLane(workerIndex);
         }
-        for (int32 index = 0; index < workerCount; index++)
+        // Parked workers can't be woken selectively
+        else if (_getCurrentWorker() != baseWorkers[workerIndex])
         {
-            asyncWorkers[index].workerThread = std::thread(&jasync_task_queue<WorkerType>::_workerThreadFunction, this, &asyncWorkers[index]);
+            _notifyWorkers(all_workers);
         }
         return true;
     }
-    template<typename WorkerType>
-    void jasync_task_queue<WorkerType>::stop()
+    inline bool jasync_task_queue_base::addPumpTask(jasync_task* task, jasync_task_counter* counter)
     {
-        if (asyncWorkerCount == 0)
+        if (!isValid() || (task == nullptr))
         {
-            return;
+            return false;
         }
 
-        for (int32 index = 0; index < asyncWorkerCount; index++)
+        _addPrivateTask(pumpLane, task, counter);
+        // Pump thread could sleep only in wait(), pairs with its increment of counterWaitersCount
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (counterWaitersCount.load(std::memory_order_relaxed) > 0)
         {
-            asyncWorkers[index].shouldStop = true;
+            _wakeWorkers(all_workers);
         }
-        taskAvailableCondition.notify_all();
-        for (int32 index = 0; index < asyncWorkerCount; index++)
+        return true;
+    }
+    inline int32 jasync_task_queue_base::pump(const int32 budget)
+    {
+        if (!isPumpThread())
         {
-            asyncWorkers[index].workerThread.join();
-            asyncWorkers[index].onStop_MainThread();
-            memory::destruct(asyncWorkers + index);
+            return 0;
         }
 
-        memory::deallocate(asyncWorkers, asyncWorkerCount);
-        asyncWorkers = nullptr;
-        asyncWorkerCount = 0;
-
-        for (const auto& task : tasksQueue)
+        int32 executedTasksCount = 0;
+        while (executedTasksCount < budget)
         {
-            task.clear();
+            jasync_task* task = pumpLane.pop();
+            if (task == nullptr)
+            {
+                break;
+            }
+            _executeTask(task, nullptr);
+            executedTasksCount++;
         }
-        tasksQueue.clear();
+        return executedTasksCount;
     }
-
-    template<typename WorkerType>
-    void jasync_task_queue<WorkerType>::_workerThreadFunction(worker_type* worker)
+    inline void jasync_task_queue_base::clearTasks()
     {
-        if (!worker->onStart_WorkerThread())
+        if (!isValid())
         {
             return;
         }
 
-        while (true)
+        _clearQueuedTasks();
+    }
+    inline void jasync_task_queue_base::wait(const jasync_task_counter& counter)
+    {
+        jasync_worker* worker = _getCurrentWorker();
+        int32 idleIteration = 0;
+        while (!counter.isDone())
         {
-            std::unique_lock lock(tasksQueueMutex);
-            if (worker->shouldStop)
-            {
-                break;
-            }
-            bool shouldStopWorker = false;
-            while (!shouldStopWorker && tasksQueue.empty())
-            {
-                taskAvailableCondition.wait(lock);
-                if (worker->shouldStop)
-                {
-                    shouldStopWorker = true;
-                }
-            }
-            if (shouldStopWorker)
+            jasync_task* task = _pullTask(worker);
+            if (task != nullptr)
             {
-                break;
+                _executeTask(task, worker);
+                idleIteration = 0;
+                continue;
             }
-            const task_description task = tasksQueue.front();
-            tasksQueue.pop_front();
-            lock.unlock();
 
-            if (task.task != nullptr)
-            {
-                task.task->run();
-                task.clear();
-            }
-            if (worker->shouldStop)
+            counterWaitersCount.fetch_add(1, std::memory_order_seq_cst);
+            _idle(idleIteration, worker, [this, &counter, worker]()
             {
-                break;
-            }
+                return (counter.pendingTasks.load(std::memory_order_seq_cst) != 0) && !_hasQueuedTasks(worker) && !_hasPrivateTasks(worker);
+            });
+            counterWaitersCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    inline void jasync_task_queue_base::_createInlineTasks(const int32 count)
+    {
+        if (count <= 0)
+        {
+            return;
+        }
+
+        inlineTasks = memory::allocate<jasync_task_inline>(count);
+        inlineTasksCount = count;
+        freeInlineTasks.init(count);
+        for (int32 index = 0; index < count; index++)
+        {
+            memory::construct(inlineTasks + index);
+            inlineTasks[index].inlineTask = true;
+            freeInlineTasks.push(inlineTasks + index);
+        }
+    }
+    inline void jasync_task_queue_base::_destroyInlineTasks()
+    {
+        for (int32 index = 0; index < inlineTasksCount; index++)
+        {
+            memory::destruct(inlineTasks + index);
+        }
+        memory::deallocate(inlineTasks, inlineTasksCount);
+        inlineTasks = nullptr;
+        inlineTasksCount = 0;
+        freeInlineTasks.init(0);
+    }
+    inline void jasync_task_queue_base::_createWorkerLanes(const int32 count)
+    {
+        workerLanes = memory::allocate<task_lane>(count);
+        for (int32 index = 0; index < count; index++)
+        {
+            memory::construct(workerLanes + index);
+        }
+    }
+    inline void jasync_task_queue_base::_destroyWorkerLanes()
+    {
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            memory::destruct(workerLanes + index);
+        }
+        memory::deallocate(workerLanes, workersCapacity);
+        workerLanes = nullptr;
+    }
+    inline void jasync_task_queue_base::_addPrivateTask(task_lane& lane, jasync_task* task, jasync_task_counter* counter)
+    {
+        task->taskCounter = counter;
+        task->taskPriority = jasync_task_priority::normal;
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        task->enqueueTime = jutils_private::jasync_stats_time();
+#endif
+        if (counter != nullptr)
+        {
+            counter->pendingTasks.fetch_add(1, std::memory_order_relaxed);
+        }
+        _countSubmittedTasks(_getCurrentWorker(), 1);
+        lane.push(&task, 1);
+    }
+    inline jasync_task_queue_base::task_lane* jasync_task_queue_base::_getPrivateLane(const jasync_worker* worker)
+    {
+        if (worker != nullptr)
+        {
+            return workerLanes + worker->workerIndex;
+        }
+        return isPumpThread() ? &pumpLane : nullptr;
+    }
+    template<typename Func>
+    jasync_task* jasync_task_queue_base::_createFunctionTask(Func&& function)
+    {
+        if constexpr (jasync_task_inline::can_store<Func>)
+        {
+            jasync_task_inline* task = nullptr;
+            if (freeInlineTasks.pop(task))
+            {
+                task->_setFunction(std::forward<Func>(function));
+                return task;
+            }
+        }
+        return new jasync_task_function<std::decay_t<Func>>(std::forward<Func>(function));
+    }
+
+    inline jasync_worker* jasync_task_queue_base::_getCurrentWorker() const
+    {
+        if ((CurrentWorker == nullptr) || (CurrentWorker->ownerQueue != this))
+        {
+            return nullptr;
+        }
+        return CurrentWorker;
+    }
+
+    inline bool jasync_task_queue_base::_canExecuteAllLanes(const int32 workerCount) const
+    {
+        for (int32 laneIndex = 0; laneIndex < jasync_task_priority_count; laneIndex++)
+        {
+            bool laneHasWorker = false;
+            for (int32 index = 0; (index < workerCount) && !laneHasWorker; index++)
+            {
+                laneHasWorker = baseWorkers[index]->allowedLanes[laneIndex];
+            }
+            if (!laneHasWorker)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    inline void jasync_task_queue_base::_placeWorkers(const jasync_task_queue_settings& settings)
+    {
+        numaNodesCount = 1;
+        workerThreadName = settings.threadName;
+        if (settings.affinity == jasync_worker_affinity::none)
+        {
+            return;
+        }
+
+        // Nodes are limited to the requested CPUs, empty ones are dropped
+        std::vector<std::vector<int32>> nodes = thread::getNumaNodes();
+        if (!settings.affinityCpus.empty())
+        {
+            for (auto& nodeCpus : nodes)
+            {
+                std::erase_if(nodeCpus, [&settings](const int32 cpu)
+                {
+                    return std::find(settings.affinityCpus.begin(), settings.affinityCpus.end(), cpu) == settings.affinityCpus.end();
+                });
+            }
+            std::erase_if(nodes, [](const std::vector<int32>& nodeCpus) { return nodeCpus.empty(); });
+            if (nodes.empty())
+            {
+                nodes.push_back(settings.affinityCpus);
+            }
+        }
+
+        numaNodesCount = static_cast<int32>(nodes.size());
+        if (settings.affinity == jasync_worker_affinity::numa_node)
+        {
+            // Neighbour workers share a node
+            for (int32 index = 0; index < workersCapacity; index++)
+            {
+                const int32 node = static_cast<int32>(static_cast<int64>(index) * numaNodesCount / workersCapacity);
+                baseWorkers[index]->numaNode = node;
+                baseWorkers[index]->cpus = nodes[node];
+            }
+            return;
+        }
+
+        std::vector<int32> cpus;
+        std::vector<int32> cpuNodes;
+        for (int32 node = 0; node < numaNodesCount; node++)
+        {
+            cpus.insert(cpus.end(), nodes[node].begin(), nodes[node].end());
+            cpuNodes.insert(cpuNodes.end(), nodes[node].size(), node);
+        }
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            const std::size_t cpuIndex = static_cast<std::size_t>(index) % cpus.size();
+            baseWorkers[index]->numaNode = cpuNodes[cpuIndex];
+            baseWorkers[index]->cpus = { cpus[cpuIndex] };
+        }
+    }
+    inline void jasync_task_queue_base::_setupWorkerThread(const jasync_worker* worker) const
+    {
+        if (!workerThreadName.empty())
+        {
+            thread::setCurrentThreadName((workerThreadName + ' ' + std::to_string(worker->workerIndex)).c_str());
+        }
+        if (!worker->cpus.empty())
+        {
+            thread::setCurrentThreadAffinity(worker->cpus);
+        }
+    }
+
+    template<typename TaskGetter>
+    void jasync_task_queue_base::task_lane::push(const std::size_t tasksCount, TaskGetter getTask)
+    {
+        std::size_t index = 0;
+        if (tasksQueueSize.load(std::memory_order_acquire) == 0)
+        {
+            // While the overflow list is not empty everything goes there, so the ring can't overtake older tasks forever
+            for (; index < tasksCount; index++)
+            {
+                jasync_task* task = getTask(index);
+                if ((task != nullptr) && !tasksRing.push(task))
+                {
+                    break;
+                }
+            }
+        }
+        if (index < tasksCount)
+        {
+            std::lock_guard lock(tasksQueueMutex);
+            std::size_t queueSize = tasksQueueSize.load(std::memory_order_relaxed);
+            for (; index < tasksCount; index++)
+            {
+                jasync_task* task = getTask(index);
+                if (task == nullptr)
+                {
+                    continue;
+                }
+
+                task->nextTask = nullptr;
+                if (tasksQueueTail != nullptr)
+                {
+                    tasksQueueTail->nextTask = task;
+                }
+                else
+                {
+                    tasksQueueHead = task;
+                }
+                tasksQueueTail = task;
+                queueSize++;
+            }
+            tasksQueueSize.store(queueSize, std::memory_order_release);
+        }
+    }
+    inline jasync_task* jasync_task_queue_base::task_lane::pop()
+    {
+        jasync_task* task = nullptr;
+        if (tasksRing.pop(task))
+        {
+            return task;
+        }
+        if (tasksQueueSize.load(std::memory_order_acquire) == 0)
+        {
+            return nullptr;
+        }
+
+        std::lock_guard lock(tasksQueueMutex);
+        if (tasksQueueHead == nullptr)
+        {
+            return nullptr;
+        }
+        task = tasksQueueHead;
+        tasksQueueHead = task->nextTask;
+        if (tasksQueueHead == nullptr)
+        {
+            tasksQueueTail = nullptr;
+        }
+        task->nextTask = nullptr;
+        tasksQueueSize.store(tasksQueueSize.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+        return task;
+    }
+
+    inline jasync_task* jasync_task_queue_base::_pullTask(jasync_worker* worker)
+    {
+        static thread_local uint32 ExternalPickCounter = 0;
+        uint32& pickCounter = worker != nullptr ? worker->pickCounter : ExternalPickCounter;
+        const bool lowPriorityFirst = (lowPriorityPickInterval > 0) && ((++pickCounter % static_cast<uint32>(lowPriorityPickInterval)) == 0);
+
+        jasync_task* task = nullptr;
+        task_lane* privateLane = _getPrivateLane(worker);
+        if ((privateLane != nullptr) && (privateLane->getSize() > 0))
+        {
+            task = privateLane->pop();
+            if (task != nullptr)
+            {
+                return task;
+            }
+        }
+        if (lowPriorityFirst)
+        {
+            task = _pullLaneTask(worker, jasync_task_priority::background);
+            if (task == nullptr)
+            {
+                task = _pullLaneTask(worker, jasync_task_priority::normal);
+            }
+            if (task != nullptr)
+            {
+                return task;
+            }
+        }
+
+        task = _pullLaneTask(worker, jasync_task_priority::high);
+        if (task != nullptr)
+        {
+            return task;
+        }
+        const bool workStealing = queueMode == jasync_task_queue_mode::work_stealing;
+        if (workStealing && (worker != nullptr) && worker->localTasks.pop(task))
+        {
+            return task;
+        }
+        task = _pullLaneTask(worker, jasync_task_priority::normal);
+        if (task != nullptr)
+        {
+            return task;
+        }
+        if (workStealing && ((worker == nullptr) || worker->allowedLanes[static_cast<uint8>(jasync_task_priority::normal)]))
+        {
+            task = _stealTask(worker);
+            if (task != nullptr)
+            {
+                return task;
+            }
+        }
+        return _pullLaneTask(worker, jasync_task_priority::background);
+    }
+    inline jasync_task* jasync_task_queue_base::_pullLaneTask(jasync_worker* worker, const jasync_task_priority priority)
+    {
+        if ((worker != nullptr) && !worker->allowedLanes[static_cast<uint8>(priority)])
+        {
+            return nullptr;
+        }
+
+        task_lane& lane = _getLane(priority);
+        if (lane.getSize() == 0)
+        {
+            return nullptr;
+        }
+        jasync_task* task = lane.pop();
+        if ((task != nullptr) && (worker != nullptr) && (priority == jasync_task_priority::normal) && (queueMode == jasync_task_queue_mode::work_stealing))
+        {
+            // Move a share of the shared queue into the local deque, so other workers could steal it without touching the shared queue
+            const std::size_t workerCount = static_cast<std::size_t>(jutils::math::max(asyncWorkerCount.load(std::memory_order_relaxed), 1));
+            const std::size_t batchSize = jutils::math::min(lane.getSize() / workerCount, static_cast<std::size_t>(32));
+            for (std::size_t index = 0; index < batchSize; index++)
+            {
+                jasync_task* batchTask = lane.pop();
+                if (batchTask == nullptr)
+                {
+                    break;
+                }
+                worker->localTasks.push(batchTask);
+            }
+        }
+        return task;
+    }
+    inline jasync_task* jasync_task_queue_base::_stealTask(jasync_worker* thief)
+    {
+        const int32 workerCount = asyncWorkerCount.load(std::memory_order_acquire);
+        if (workerCount == 0)
+        {
+            return nullptr;
+        }
+        int32 startIndex = 0;
+        if (thief != nullptr)
+        {
+            thief->stealSeed ^= thief->stealSeed << 13;
+            thief->stealSeed ^= thief->stealSeed >> 17;
+            thief->stealSeed ^= thief->stealSeed << 5;
+            startIndex = static_cast<int32>(thief->stealSeed % static_cast<uint32>(workerCount));
+        }
+
+        // Victims from the thief's NUMA node go first, so tasks don't migrate between nodes while there is local work
+        const bool sameNodeFirst = (thief != nullptr) && (numaNodesCount > 1);
+        jasync_task* task = nullptr;
+        for (int32 pass = sameNodeFirst ? 0 : 1; pass < 2; pass++)
+        {
+            for (int32 offset = 0; offset < workerCount; offset++)
+            {
+                jasync_worker* victim = baseWorkers[(startIndex + offset) % workerCount];
+                if ((victim == thief) || (sameNodeFirst && ((victim->numaNode == thief->numaNode) != (pass == 0))))
+                {
+                    continue;
+                }
+                if (victim->localTasks.steal(task))
+                {
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+                    jutils_private::jasync_worker_stats_data& stats = thief != nullptr ? thief->stats : externalStats;
+                    stats.add(stats.stolenTasks, 1, thief == nullptr);
+#endif
+                    return task;
+                }
+            }
+        }
+        return nullptr;
+    }
+    inline bool jasync_task_queue_base::_hasQueuedTasks(const jasync_worker* worker)
+    {
+        // Only the tasks the worker could pull, otherwise it would spin while the task waits for a parked worker
+        for (int32 laneIndex = 0; laneIndex < jasync_task_priority_count; laneIndex++)
+        {
+            if (((worker == nullptr) || worker->allowedLanes[laneIndex]) && (taskLanes[laneIndex].getSize() > 0))
+            {
+                return true;
+            }
+        }
+        if ((queueMode == jasync_task_queue_mode::work_stealing)
+            && ((worker == nullptr) || worker->allowedLanes[static_cast<uint8>(jasync_task_priority::normal)]))
+        {
+            const int32 workerCount = asyncWorkerCount.load(std::memory_order_acquire);
+            for (int32 index = 0; index < workerCount; index++)
+            {
+                if (!baseWorkers[index]->localTasks.isEmpty())
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    inline int64 jasync_task_queue_base::_getQueuedTasksCount() const
+    {
+        int64 queuedTasksCount = 0;
+        for (const auto& lane : taskLanes)
+        {
+            queuedTasksCount += static_cast<int64>(lane.getSize());
+        }
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            queuedTasksCount += baseWorkers[index]->localTasks.getSize() + static_cast<int64>(workerLanes[index].getSize());
+        }
+        return queuedTasksCount + static_cast<int64>(pumpLane.getSize());
+    }
+    inline void jasync_task_queue_base::_clearQueuedTasks()
+    {
+        jasync_worker* worker = _getCurrentWorker();
+        for (auto& lane : taskLanes)
+        {
+            _clearLane(lane, worker);
+        }
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            _clearLane(workerLanes[index], worker);
+        }
+        _clearLane(pumpLane, worker);
+        if (queueMode == jasync_task_queue_mode::work_stealing)
+        {
+            for (int32 index = 0; index < workersCapacity; index++)
+            {
+                jasync_task* task = nullptr;
+                while (!baseWorkers[index]->localTasks.isEmpty())
+                {
+                    if (baseWorkers[index]->localTasks.steal(task))
+                    {
+                        _finishTask(task, worker);
+                    }
+                }
+            }
+        }
+    }
+    inline void jasync_task_queue_base::_clearLane(task_lane& lane, jasync_worker* worker)
+    {
+        jasync_task* sharedTask = nullptr;
+        while (lane.tasksRing.pop(sharedTask))
+        {
+            _finishTask(sharedTask, worker);
+        }
+
+        std::lock_guard lock(lane.tasksQueueMutex);
+        jasync_task* task = lane.tasksQueueHead;
+        lane.tasksQueueHead = nullptr;
+        lane.tasksQueueTail = nullptr;
+        lane.tasksQueueSize.store(0, std::memory_order_release);
+        while (task != nullptr)
+        {
+            jasync_task* nextTask = task->nextTask;
+            task->nextTask = nullptr;
+            _finishTask(task, worker);
+            task = nextTask;
+        }
+    }
+    inline void jasync_task_queue_base::_moveLocalTasks(jasync_worker* worker)
+    {
+        jasync_task* task = nullptr;
+        while (worker->localTasks.pop(task))
+        {
+            _getLane(jasync_task_priority::normal).push(&task, 1);
+        }
+        _notifyWorkers(all_workers);
+    }
+    inline void jasync_task_queue_base::_moveWorkerLane(const int32 workerIndex)
+    {
+        task_lane& lane = workerLanes[workerIndex];
+        bool tasksMoved = false;
+        for (jasync_task* task = lane.pop(); task != nullptr; task = lane.pop())
+        {
+            _getLane(task->taskPriority).push(&task, 1);
+            tasksMoved = true;
+        }
+        if (tasksMoved)
+        {
+            _notifyWorkers(all_workers);
+        }
+    }
+
+    inline void jasync_task_queue_base::releaseCounter(jasync_task_counter& counter)
+    {
+        // Counter could be destroyed by a waiting thread right after the decrement, so it's the last access to it
+        if ((counter.pendingTasks.fetch_sub(1, std::memory_order_seq_cst) == 1) && (counterWaitersCount.load(std::memory_order_seq_cst) > 0))
+        {
+            _wakeWorkers(all_workers);
+        }
+    }
+
+    inline void jasync_task_queue_base::getStats(jasync_task_queue_stats& outStats) const
+    {
+        outStats.queuedTasks = _getQueuedTasksCount();
+        outStats.parkedThreads = parkedThreadsCount.load(std::memory_order_relaxed);
+        outStats.workers.resize(workersCapacity);
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            baseWorkers[index]->stats.copyTo(outStats.workers[index]);
+        }
+        externalStats.copyTo(outStats.externalThreads);
+#endif
+    }
+
+    inline void jasync_task_queue_base::_executeTask(jasync_task* task, [[maybe_unused]] jasync_worker* worker)
+    {
+        const task_description description(task);
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        jutils_private::jasync_worker_stats_data& stats = worker != nullptr ? worker->stats : externalStats;
+        const int64 startTime = jutils_private::jasync_stats_time();
+        stats.addLatency(startTime - task->enqueueTime, worker == nullptr);
+#endif
+        if (task->isCancelled())
+        {
+            _finishTask(description, worker);
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+            stats.add(stats.cancelledTasks, 1, worker == nullptr);
+#endif
+            return;
+        }
+        task->run();
+        _finishTask(description, worker);
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        stats.add(stats.busyTimeNs, static_cast<uint64>(jutils_private::jasync_stats_time() - startTime), worker == nullptr);
+        stats.add(stats.executedTasks, 1, worker == nullptr);
+#endif
+    }
+    inline void jasync_task_queue_base::_finishTask(jasync_task* task, jasync_worker* worker)
+    {
+        if (task != nullptr)
+        {
+            _finishTask(task_description(task), worker);
+        }
+    }
+    inline void jasync_task_queue_base::_finishTask(const task_description& description, jasync_worker* worker)
+    {
+        if (description.timerHandle.isValid())
+        {
+            _rescheduleTimer(description);
+        }
+        else
+        {
+            _releaseTask(description);
+        }
+
+        // Release pairs with acquire loads in _isIdle()
+        if (worker != nullptr)
+        {
+            worker->finishedTasks.store(worker->finishedTasks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        else
+        {
+            externalFinishedTasks.fetch_add(1, std::memory_order_release);
+        }
+    }
+    inline void jasync_task_queue_base::_releaseTask(const task_description& description)
+    {
+        if (description.inlineTask)
+        {
+            jasync_task_inline* inlineTask = static_cast<jasync_task_inline*>(description.task);
+            inlineTask->_resetFunction();
+            inlineTask->cancellationToken = nullptr;
+            freeInlineTasks.push(inlineTask);
+        }
+        else if (description.deleteTask)
+        {
+            delete description.task;
+        }
+        if (description.counter != nullptr)
+        {
+            releaseCounter(*description.counter);
+        }
+    }
+
+    inline void jasync_task_queue_base::_countSubmittedTasks(jasync_worker* worker, const uint64 tasksCount)
+    {
+        if (worker != nullptr)
+        {
+            worker->submittedTasks.store(worker->submittedTasks.load(std::memory_order_relaxed) + tasksCount, std::memory_order_relaxed);
+        }
+        else
+        {
+            externalSubmittedTasks.fetch_add(tasksCount, std::memory_order_relaxed);
+        }
+    }
+    inline bool jasync_task_queue_base::_isIdle() const
+    {
+        // Task is counted as submitted before it could be finished, so finished counters have to be read first:
+        // if they sum up to submitted counters read after them, nothing was queued or running at some moment in between
+        uint64 finishedTasksCount = externalFinishedTasks.load(std::memory_order_acquire);
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            finishedTasksCount += baseWorkers[index]->finishedTasks.load(std::memory_order_acquire);
+        }
+        uint64 submittedTasksCount = externalSubmittedTasks.load(std::memory_order_relaxed);
+        for (int32 index = 0; index < workersCapacity; index++)
+        {
+            submittedTasksCount += baseWorkers[index]->submittedTasks.load(std::memory_order_relaxed);
+        }
+        return finishedTasksCount == submittedTasksCount;
+    }
+    inline bool jasync_task_queue_base::_shouldWorkerExit(const jasync_worker* worker) const
+    {
+        if (worker->shouldStop)
+        {
+            return true;
+        }
+        if (!stopRequested.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        return !drainOnStop.load(std::memory_order_relaxed) || _isIdle();
+    }
+
+    inline void jasync_task_queue_base::requestStop(const bool drain)
+    {
+        if (!isValid())
+        {
+            return;
+        }
+
+        drainOnStop.store(drain, std::memory_order_relaxed);
+        stopRequested.store(true, std::memory_order_release);
+        _wakeWorkers(all_workers);
+    }
+    inline bool jasync_task_queue_base::waitForIdle(const std::chrono::nanoseconds timeout)
+    {
+        if (!isValid())
+        {
+            return true;
+        }
+
+        const auto startTime = std::chrono::steady_clock::now();
+        jasync_worker* worker = _getCurrentWorker();
+        int32 idleIteration = 0;
+        while (!_isIdle())
+        {
+            if ((std::chrono::steady_clock::now() - startTime) >= timeout)
+            {
+                return false;
+            }
+
+            jasync_task* task = _pullTask(worker);
+            if (task != nullptr)
+            {
+                _executeTask(task, worker);
+                idleIteration = 0;
+                continue;
+            }
+            // Nothing wakes this thread when running tasks are finished, so it sleeps a bit instead of parking
+            if (idleIteration < (spinCount + yieldCount))
+            {
+                idleIteration++;
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        if (isStopRequested())
+        {
+            // Last task could be finished here, parked workers have to see it and exit
+            _wakeWorkers(all_workers);
+        }
+        return true;
+    }
+
+    inline jtimer_handle jasync_task_queue_base::addDelayedTask(jasync_task* task, const std::chrono::nanoseconds delay, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
+    {
+        return _addTimer(task, delay, 0, priority, counter);
+    }
+    inline jtimer_handle jasync_task_queue_base::addPeriodicTask(jasync_task* task, const std::chrono::nanoseconds period, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
+    {
+        const int64 periodTicks = period.count() / timerResolutionNs + ((period.count() % timerResolutionNs) > 0 ? 1 : 0);
+        return _addTimer(task, period, jutils::math::max(periodTicks, 1), priority, counter);
+    }
+    inline bool jasync_task_queue_base::cancelTimer(const jtimer_handle& handle)
+    {
+        timer_record cancelledRecord;
+        {
+            std::lock_guard lock(timersMutex);
+            timer_record* record = timerWheel.get(handle);
+            if ((record == nullptr) || record->cancelled)
+            {
+                return false;
+            }
+            if (!timerWheel.isScheduled(handle))
+            {
+                // Periodic task is queued or running, it's released after the run
+                record->cancelled = true;
+                return true;
+            }
+            cancelledRecord = *record;
+            timerWheel.destroy(handle);
+            timersCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        _releaseTimerTask(cancelledRecord);
+        return true;
+    }
+
+    inline int64 jasync_task_queue_base::_getTimerTick() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timersStartTime).count() / timerResolutionNs;
+    }
+    inline jtimer_handle jasync_task_queue_base::_addTimer(jasync_task* task, const std::chrono::nanoseconds delay, const int64 periodTicks, 
+        const jasync_task_priority priority, jasync_task_counter* counter)
+    {
+        if (!isValid() || (task == nullptr))
+        {
+            return {};
+        }
+
+        const int64 delayTicks = delay.count() / timerResolutionNs + ((delay.count() % timerResolutionNs) > 0 ? 1 : 0);
+        if (counter != nullptr)
+        {
+            retainCounter(*counter);
+        }
+        jtimer_handle handle;
+        bool earliestTimer = false;
+        {
+            std::lock_guard lock(timersMutex);
+            // Current tick is already partially passed
+            const int64 expireTick = _getTimerTick() + jutils::math::max(delayTicks, 0) + 1;
+            handle = timerWheel.create({ task, counter, priority, periodTicks, false });
+            timerWheel.schedule(handle, expireTick);
+            if (periodTicks > 0)
+            {
+                task->timerHandle = handle;
+            }
+            timersCount.fetch_add(1, std::memory_order_relaxed);
+            if (expireTick < nextTimerTick.load(std::memory_order_relaxed))
+            {
+                nextTimerTick.store(expireTick, std::memory_order_relaxed);
+                earliestTimer = true;
+            }
+        }
+        // Keeper has to sleep less, or there is no keeper yet
+        if (!timerKeeperActive.load(std::memory_order_relaxed))
+        {
+            _notifyWorkers(1);
+        }
+        else if (earliestTimer)
+        {
+            _wakeTimerKeeper();
+        }
+        return handle;
+    }
+    inline bool jasync_task_queue_base::_serviceTimers()
+    {
+        if ((timersCount.load(std::memory_order_relaxed) == 0) || stopRequested.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        const int64 timerTick = _getTimerTick();
+        if (timerTick < nextTimerTick.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        std::unique_lock lock(timersMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            return false;
+        }
+
+        bool timersFired = false;
+        timerWheel.advance(timerTick, [this, &timersFired](const jtimer_handle handle, const timer_record& record)
+        {
+            timersFired = true;
+            if (record.periodTicks > 0)
+            {
+                addTask(record.task, record.priority, nullptr);
+                return;
+            }
+
+            const timer_record firedRecord = record;
+            timerWheel.destroy(handle);
+            timersCount.fetch_sub(1, std::memory_order_relaxed);
+            addTask(firedRecord.task, firedRecord.priority, firedRecord.counter);
+            if (firedRecord.counter != nullptr)
+            {
+                releaseCounter(*firedRecord.counter);
+            }
+        });
+        nextTimerTick.store(timerWheel.getNextTick(), std::memory_order_relaxed);
+        return timersFired;
+    }
+    inline bool jasync_task_queue_base::_claimTimerKeeper()
+    {
+        return (timersCount.load(std::memory_order_relaxed) > 0) && !stopRequested.load(std::memory_order_relaxed)
+            && !timerKeeperActive.exchange(true, std::memory_order_acquire);
+    }
+    inline void jasync_task_queue_base::_releaseTimerKeeper()
+    {
+        timerKeeperActive.store(false, std::memory_order_release);
+        // Some parked worker has to take the timers
+        if (timersCount.load(std::memory_order_relaxed) > 0)
+        {
+            _notifyWorkers(1);
+        }
+    }
+    template<typename Predicate>
+    void jasync_task_queue_base::_parkTimerKeeper(const jasync_worker* worker, Predicate canPark)
+    {
+        // Same protocol as in _idle(), the next timer tick is read after the fence so a new earlier timer can't be missed
+        _countParkedThread(worker);
+        timerKeeperParked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const uint32 epoch = wakeEpoch.load(std::memory_order_acquire);
+        const int64 timerTick = nextTimerTick.load(std::memory_order_relaxed);
+        if (canPark())
+        {
+            std::unique_lock lock(timerKeeperMutex);
+            auto isWoken = [this, epoch]() { return wakeEpoch.load(std::memory_order_acquire) != epoch; };
+            if ((timerTick == timer_wheel_type::invalid_tick) || stopRequested.load(std::memory_order_relaxed))
+            {
+                timerKeeperCondition.wait(lock, isWoken);
+            }
+            else
+            {
+                timerKeeperCondition.wait_until(lock, timersStartTime + std::chrono::nanoseconds(timerTick * timerResolutionNs), isWoken);
+            }
+        }
+        timerKeeperParked.store(false, std::memory_order_relaxed);
+        _uncountParkedThread(worker);
+    }
+    inline void jasync_task_queue_base::_rescheduleTimer(const task_description& description)
+    {
+        timer_record cancelledRecord;
+        bool earliestTimer = false;
+        {
+            std::lock_guard lock(timersMutex);
+            timer_record* record = timerWheel.get(description.timerHandle);
+            if (record == nullptr)
+            {
+                return;
+            }
+            if (!record->cancelled && !description.task->isCancelled() && !stopRequested.load(std::memory_order_relaxed))
+            {
+                // Keeps the phase of the timer, periods that are already missed are skipped
+                const int64 timerTick = _getTimerTick();
+                int64 expireTick = timerWheel.getExpireTick(description.timerHandle) + record->periodTicks;
+                if (expireTick <= timerTick)
+                {
+                    expireTick += ((timerTick - expireTick) / record->periodTicks + 1) * record->periodTicks;
+                }
+                timerWheel.schedule(description.timerHandle, expireTick);
+                if (expireTick < nextTimerTick.load(std::memory_order_relaxed))
+                {
+                    nextTimerTick.store(expireTick, std::memory_order_relaxed);
+                    earliestTimer = true;
+                }
+            }
+            else
+            {
+                cancelledRecord = *record;
+                timerWheel.destroy(description.timerHandle);
+                timersCount.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if (cancelledRecord.task != nullptr)
+        {
+            _releaseTimerTask(cancelledRecord);
+        }
+        else if (!timerKeeperActive.load(std::memory_order_relaxed))
+        {
+            _notifyWorkers(1);
+        }
+        else if (earliestTimer)
+        {
+            _wakeTimerKeeper();
+        }
+    }
+    inline void jasync_task_queue_base::_releaseTimerTask(const timer_record& record)
+    {
+        task_description description(record.task);
+        description.counter = record.counter;
+        description.timerHandle = {};
+        record.task->timerHandle = {};
+        _releaseTask(description);
+    }
+    inline void jasync_task_queue_base::_clearTimers()
+    {
+        std::vector<timer_record> records;
+        {
+            std::lock_guard lock(timersMutex);
+            records.reserve(timerWheel.getSize());
+            timerWheel.forEach([&records](const jtimer_handle, const timer_record& record) { records.push_back(record); });
+            timerWheel.reset(0);
+            timersCount.store(0, std::memory_order_relaxed);
+            nextTimerTick.store(timer_wheel_type::invalid_tick, std::memory_order_relaxed);
+        }
+        for (const auto& record : records)
+        {
+            _releaseTimerTask(record);
+        }
+    }
+
+    template<typename Predicate>
+    void jasync_task_queue_base::_idle(int32& idleIteration, const jasync_worker* worker, Predicate canPark)
+    {
+        if (idleIteration < spinCount)
+        {
+            idleIteration++;
+            jutils_private::jasync_cpu_relax();
+            return;
+        }
+        if (idleIteration < (spinCount + yieldCount))
+        {
+            idleIteration++;
+            std::this_thread::yield();
+            return;
+        }
+
+        // Pairs with the fence in _notifyWorkers(): either the producer sees this thread parked or canPark() sees its task
+        idleIteration = 0;
+        _countParkedThread(worker);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const uint32 epoch = wakeEpoch.load(std::memory_order_acquire);
+        if (canPark())
+        {
+            wakeEpoch.wait(epoch, std::memory_order_acquire);
+        }
+        _uncountParkedThread(worker);
+    }
+    inline void jasync_task_queue_base::_countParkedThread(const jasync_worker* worker)
+    {
+        // A stale lane counter makes producers wake all threads, or counts a thread that still checks the queues before parking
+        for (int32 laneIndex = 0; laneIndex < jasync_task_priority_count; laneIndex++)
+        {
+            if ((worker == nullptr) || worker->allowedLanes[laneIndex])
+            {
+                parkedLaneThreadsCount[laneIndex].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        parkedThreadsCount.fetch_add(1, std::memory_order_seq_cst);
+    }
+    inline void jasync_task_queue_base::_uncountParkedThread(const jasync_worker* worker)
+    {
+        parkedThreadsCount.fetch_sub(1, std::memory_order_seq_cst);
+        for (int32 laneIndex = 0; laneIndex < jasync_task_priority_count; laneIndex++)
+        {
+            if ((worker == nullptr) || worker->allowedLanes[laneIndex])
+            {
+                parkedLaneThreadsCount[laneIndex].fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    inline void jasync_task_queue_base::_notifyWorkers(const int32 workersCount)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parkedThreadsCount.load(std::memory_order_relaxed) > 0)
+        {
+            _wakeWorkers(workersCount);
+        }
+    }
+    inline void jasync_task_queue_base::_notifyLaneWorkers(const int32 workersCount, const jasync_task_priority priority)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int32 parkedCount = parkedThreadsCount.load(std::memory_order_relaxed);
+        if (parkedCount > 0)
+        {
+            // notify_one() can't choose a worker that executes the lane, all parked threads are woken while some of them skip it
+            const bool skippingThreadsParked = parkedLaneThreadsCount[static_cast<uint8>(priority)].load(std::memory_order_relaxed) < parkedCount;
+            _wakeWorkers(skippingThreadsParked ? all_workers : workersCount);
+        }
+    }
+    inline void jasync_task_queue_base::_wakeWorkers(const int32 workersCount)
+    {
+        // Threads read the epoch before checking the queues, so incrementing it after a push can't be missed.
+        // Threads that are not woken keep sleeping even though the epoch is changed
+        wakeEpoch.fetch_add(1, std::memory_order_release);
+        // Pairs with the fence in _parkTimerKeeper()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const bool timerKeeperSleeps = timerKeeperParked.load(std::memory_order_relaxed);
+        const int32 parkedWorkersCount = jutils::math::max(parkedThreadsCount.load(std::memory_order_relaxed) - (timerKeeperSleeps ? 1 : 0), 0);
+        if (workersCount >= parkedWorkersCount)
+        {
+            wakeEpoch.notify_all();
+        }
+        else
+        {
+            for (int32 index = 0; index < workersCount; index++)
+            {
+                wakeEpoch.notify_one();
+            }
+        }
+
+        // Timer keeper is woken last, so it keeps servicing timers while other workers are enough
+        if (timerKeeperSleeps && (workersCount > parkedWorkersCount))
+        {
+            std::lock_guard lock(timerKeeperMutex);
+            timerKeeperCondition.notify_all();
+        }
+    }
+    inline void jasync_task_queue_base::_wakeTimerKeeper()
+    {
+        // Keeper waits for the epoch change, other parked workers are not notified so they keep sleeping.
+        // Next timer tick is stored before the fence, so the keeper either is seen parked here or reads the new tick
+        wakeEpoch.fetch_add(1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (timerKeeperParked.load(std::memory_order_relaxed))
+        {
+            std::lock_guard lock(timerKeeperMutex);
+            timerKeeperCondition.notify_all();
+        }
+    }
+
+    template<typename WorkerType>
+    template<typename... Args>
+    bool jasync_task_queue<WorkerType>::init(const int32 workerCount, Args&&... args)
+    {
+        jasync_task_queue_settings settings;
+        settings.workerCount = workerCount;
+        return init(settings, std::forward<Args>(args)...);
+    }
+    template<typename WorkerType>
+    template<typename... Args>
+    bool jasync_task_queue<WorkerType>::init(const jasync_task_queue_settings& settings, Args&&... args)
+    {
+        const int32 workerCount = settings.workerCount;
+        const int32 maxWorkerCount = jutils::math::max(settings.maxWorkerCount, workerCount);
+        if (isValid() || (workerCount <= 0))
+        {
+            return false;
+        }
+
+        asyncWorkers = memory::allocate<worker_type>(maxWorkerCount);
+        baseWorkers = memory::allocate<jasync_worker*>(maxWorkerCount);
+        workersCapacity = maxWorkerCount;
+        queueMode = settings.mode;
+        lowPriorityPickInterval = settings.lowPriorityPickInterval;
+        stopRequested.store(false, std::memory_order_relaxed);
+        drainOnStop.store(false, std::memory_order_relaxed);
+        externalSubmittedTasks.store(0, std::memory_order_relaxed);
+        externalFinishedTasks.store(0, std::memory_order_relaxed);
+        timersStartTime = std::chrono::steady_clock::now();
+        timerResolutionNs = jutils::math::max(static_cast<int64>(settings.timerResolution.count()), 1);
+        timerWheel.reset(0);
+        timersCount.store(0, std::memory_order_relaxed);
+        nextTimerTick.store(timer_wheel_type::invalid_tick, std::memory_order_relaxed);
+        timerKeeperActive.store(false, std::memory_order_relaxed);
+        spinCount = jutils::math::max(settings.spinCount, 0);
+        yieldCount = jutils::math::max(settings.yieldCount, 0);
+        minWorkerCount = jutils::math::clamp(settings.minWorkerCount, 1, maxWorkerCount);
+        scaleUpQueueDepth = jutils::math::max(settings.scaleUpQueueDepth, 1);
+        scaleDownUpdates = jutils::math::max(settings.scaleDownUpdates, 1);
+        idleUpdatesCount = 0;
+        for (auto& lane : taskLanes)
+        {
+            lane.tasksRing.init(settings.backend == jasync_task_queue_backend::lock_free_ring ? settings.ringCapacity : 0);
+        }
+        _createInlineTasks(settings.inlineTaskCount);
+        _createWorkerLanes(maxWorkerCount);
+        pumpThreadID = std::this_thread::get_id();
+        for (int32 index = 0; index < maxWorkerCount; index++)
+        {
+            memory::construct(asyncWorkers + index, std::forward<Args>(args)...);
+
+            asyncWorkers[index].workerIndex = index;
+            asyncWorkers[index].ownerQueue = this;
+            asyncWorkers[index].stealSeed = static_cast<uint32>(index) + 1;
+            for (int32 laneIndex = 0; laneIndex < jasync_task_priority_count; laneIndex++)
+            {
+                asyncWorkers[index].allowedLanes[laneIndex] = asyncWorkers[index].canExecuteTasks(static_cast<jasync_task_priority>(laneIndex));
+            }
+            baseWorkers[index] = asyncWorkers + index;
+        }
+        if (!_canExecuteAllLanes(workerCount))
+        {
+            _destroyWorkers(0);
+            return false;
+        }
+        _placeWorkers(settings);
+        for (int32 index = 0; index < workerCount; index++)
+        {
+            if (!asyncWorkers[index].onStart_MainThread())
+            {
+                _destroyWorkers(index);
+                return false;
+            }
+        }
+        for (int32 index = 0; index < workerCount; index++)
+        {
+            asyncWorkers[index].workerThread = std::thread(&jasync_task_queue<WorkerType>::_workerThreadFunction, this, &asyncWorkers[index]);
+        }
+        asyncWorkerCount.store(workerCount, std::memory_order_release);
+        return true;
+    }
+    template<typename WorkerType>
+    void jasync_task_queue<WorkerType>::stop(const bool drain, const std::chrono::nanoseconds drainTimeout)
+    {
+        if (!isValid())
+        {
+            return;
+        }
+
+        if (drain)
+        {
+            requestStop(true);
+            waitForIdle(drainTimeout);
+        }
+
+        const int32 workerCount = asyncWorkerCount.load(std::memory_order_relaxed);
+        for (int32 index = 0; index < workerCount; index++)
+        {
+            asyncWorkers[index].shouldStop = true;
+        }
+        _wakeWorkers(all_workers);
+        for (int32 index = 0; index < workerCount; index++)
+        {
+            asyncWorkers[index].workerThread.join();
+            asyncWorkers[index].onStop_MainThread();
+        }
+
+        // Periodic tasks dropped from the queues are not scheduled again
+        stopRequested.store(true, std::memory_order_relaxed);
+        _clearQueuedTasks();
+        _clearTimers();
+        _destroyWorkers(0);
+    }
+
+    template<typename WorkerType>
+    bool jasync_task_queue<WorkerType>::setWorkerCount(const int32 workerCount)
+    {
+        // Worker can't join itself
+        if (!isValid() || isStopRequested() || (workerCount <= 0) || (workerCount > workersCapacity)
+            || (_getCurrentWorker() != nullptr) || !_canExecuteAllLanes(workerCount))
+        {
+            return false;
+        }
+
+        const int32 currentWorkerCount = asyncWorkerCount.load(std::memory_order_relaxed);
+        for (int32 index = currentWorkerCount; index < workerCount; index++)
+        {
+            if (!asyncWorkers[index].onStart_MainThread())
+            {
+                return false;
+            }
+            asyncWorkers[index].shouldStop = false;
+            asyncWorkers[index].workerThread = std::thread(&jasync_task_queue<WorkerType>::_workerThreadFunction, this, &asyncWorkers[index]);
+            asyncWorkerCount.store(index + 1, std::memory_order_release);
+        }
+        if (workerCount < currentWorkerCount)
+        {
+            // Removed workers move their local tasks to the shared queue before exit, their private tasks are moved after it
+            asyncWorkerCount.store(workerCount, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (int32 index = workerCount; index < currentWorkerCount; index++)
+            {
+                asyncWorkers[index].shouldStop = true;
+            }
+            _wakeWorkers(all_workers);
+            for (int32 index = workerCount; index < currentWorkerCount; index++)
+            {
+                asyncWorkers[index].workerThread.join();
+                asyncWorkers[index].onStop_MainThread();
+                _moveWorkerLane(index);
+            }
+        }
+        return true;
+    }
+    template<typename WorkerType>
+    void jasync_task_queue<WorkerType>::updateWorkerCount()
+    {
+        if (!isValid())
+        {
+            return;
+        }
+
+        const int32 workerCount = asyncWorkerCount.load(std::memory_order_relaxed);
+        const int64 queuedTasksCount = _getQueuedTasksCount();
+        if ((queuedTasksCount > static_cast<int64>(workerCount) * scaleUpQueueDepth) && (workerCount < workersCapacity))
+        {
+            idleUpdatesCount = 0;
+            setWorkerCount(workerCount + 1);
+            return;
+        }
+        if ((queuedTasksCount > 0) || (parkedThreadsCount.load(std::memory_order_relaxed) == 0))
+        {
+            idleUpdatesCount = 0;
+            return;
+        }
+        if ((++idleUpdatesCount >= scaleDownUpdates) && (workerCount > minWorkerCount))
+        {
+            idleUpdatesCount = 0;
+            setWorkerCount(workerCount - 1);
+        }
+    }
+
+    template<typename WorkerType>
+    void jasync_task_queue<WorkerType>::_destroyWorkers(const int32 startedCount)
+    {
+        for (int32 index = startedCount - 1; index >= 0; index--)
+        {
+            asyncWorkers[index].onStop_MainThread();
+        }
+        for (int32 index = workersCapacity - 1; index >= 0; index--)
+        {
+            memory::destruct(asyncWorkers + index);
+        }
+        memory::deallocate(baseWorkers, workersCapacity);
+        memory::deallocate(asyncWorkers, workersCapacity);
+        _destroyWorkerLanes();
+        pumpThreadID = std::thread::id();
+        baseWorkers = nullptr;
+        asyncWorkers = nullptr;
+        asyncWorkerCount.store(0, std::memory_order_relaxed);
+        workersCapacity = 0;
+
+        for (auto& lane : taskLanes)
+        {
+            lane.tasksRing.init(0);
+        }
+        _destroyInlineTasks();
+    }
+
+    template<typename WorkerType>
+    void jasync_task_queue<WorkerType>::_workerThreadFunction(worker_type* worker)
+    {
+        // Before the hook, so memory it touches first lands on the worker's node
+        _setupWorkerThread(worker);
+        if (!worker->onStart_WorkerThread())
+        {
+            return;
+        }
+
+        CurrentWorker = worker;
+        int32 idleIteration = 0;
+        int32 executedTasksCount = 0;
+        bool timerKeeper = false;
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        int64 idleStartTime = -1;
+#endif
+        while (!_shouldWorkerExit(worker))
+        {
+            jasync_task* task = _pullTask(worker);
+            if (task != nullptr)
+            {
+                if (timerKeeper)
+                {
+                    timerKeeper = false;
+                    _releaseTimerKeeper();
+                }
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+                if (idleStartTime >= 0)
+                {
+                    worker->stats.add(worker->stats.idleTimeNs, static_cast<uint64>(jutils_private::jasync_stats_time() - idleStartTime), false);
+                    idleStartTime = -1;
+                }
+#endif
+                _executeTask(task, worker);
+                idleIteration = 0;
+                if (++executedTasksCount == timers_check_interval)
+                {
+                    executedTasksCount = 0;
+                    _serviceTimers();
+                }
+                continue;
+            }
+
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+            if (idleStartTime < 0)
+            {
+                idleStartTime = jutils_private::jasync_stats_time();
+            }
+#endif
+            if (_serviceTimers())
+            {
+                idleIteration = 0;
+                continue;
+            }
+            if ((idleIteration >= (spinCount + yieldCount)) && (timerKeeper || _claimTimerKeeper()))
+            {
+                timerKeeper = true;
+                _parkTimerKeeper(worker, [this, worker]() { return !_shouldWorkerExit(worker) && !_hasQueuedTasks(worker) && !_hasPrivateTasks(worker); });
+                continue;
+            }
+            _idle(idleIteration, worker, [this, worker]()
+            {
+                return !_shouldWorkerExit(worker) && !_hasQueuedTasks(worker) && !_hasPrivateTasks(worker) && !_needsTimerKeeper();
+            });
+        }
+        if (timerKeeper)
+        {
+            _releaseTimerKeeper();
+        }
+#if JUTILS_ASYNC_TASK_QUEUE_STATS
+        if (idleStartTime >= 0)
+        {
+            worker->stats.add(worker->stats.idleTimeNs, static_cast<uint64>(jutils_private::jasync_stats_time() - idleStartTime), false);
         }
+#endif
+        _moveLocalTasks(worker);
+        CurrentWorker = nullptr;
 
         worker->onStop_WorkerThread();
     }
@@ -0,0 +1,413 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmpmc_ring.h"
+#include "math/math.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace jutils_private
+{
+    using jutils::int32;
+    using jutils::uint64;
+
+    // Free objects of one pool cached by one thread. Owned by both the pool and the thread, the last one deletes it
+    class jconcurrent_pool_cache
+    {
+    public:
+        jconcurrent_pool_cache() = default;
+        jconcurrent_pool_cache(const jconcurrent_pool_cache&) = delete;
+        jconcurrent_pool_cache(jconcurrent_pool_cache&&) noexcept = delete;
+        virtual ~jconcurrent_pool_cache() = default;
+
+        jconcurrent_pool_cache& operator=(const jconcurrent_pool_cache&) = delete;
+        jconcurrent_pool_cache& operator=(jconcurrent_pool_cache&&) noexcept = delete;
+
+        [[nodiscard]] bool isPoolAlive() const { return poolAlive.load(std::memory_order_acquire); }
+
+        // Cached objects go back to the pool if it's still alive
+        void onThreadExit()
+        {
+            {
+                std::lock_guard lock(ownerMutex);
+                if (poolAlive.load(std::memory_order_relaxed))
+                {
+                    _flush();
+                }
+            }
+            _release();
+        }
+        void onPoolDestroyed()
+        {
+            {
+                std::lock_guard lock(ownerMutex);
+                poolAlive.store(false, std::memory_order_release);
+            }
+            _release();
+        }
+
+    protected:
+
+        virtual void _flush() = 0;
+
+    private:
+
+        std::mutex ownerMutex;
+        std::atomic_bool poolAlive = true;
+        std::atomic<int32> references = 2;
+
+
+        void _release()
+        {
+            if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete this;
+            }
+        }
+    };
+
+    class jconcurrent_pool_thread_caches
+    {
+    public:
+        jconcurrent_pool_thread_caches() = default;
+        jconcurrent_pool_thread_caches(const jconcurrent_pool_thread_caches&) = delete;
+        jconcurrent_pool_thread_caches(jconcurrent_pool_thread_caches&&) noexcept = delete;
+        ~jconcurrent_pool_thread_caches()
+        {
+            for (const auto& entry : cacheEntries)
+            {
+                entry.cache->onThreadExit();
+            }
+        }
+
+        jconcurrent_pool_thread_caches& operator=(const jconcurrent_pool_thread_caches&) = delete;
+        jconcurrent_pool_thread_caches& operator=(jconcurrent_pool_thread_caches&&) noexcept = delete;
+
+        [[nodiscard]] jconcurrent_pool_cache* find(const uint64 poolID)
+        {
+            if ((lastEntry < static_cast<int32>(cacheEntries.size())) && (cacheEntries[lastEntry].poolID == poolID))
+            {
+                return cacheEntries[lastEntry].cache;
+            }
+            for (int32 index = 0; index < static_cast<int32>(cacheEntries.size()); index++)
+            {
+                if (cacheEntries[index].poolID == poolID)
+                {
+                    lastEntry = index;
+                    return cacheEntries[index].cache;
+                }
+            }
+            return nullptr;
+        }
+        void add(const uint64 poolID, jconcurrent_pool_cache* cache)
+        {
+            // Pool IDs are never reused, so caches of destroyed pools are only cleaned up here
+            for (int32 index = static_cast<int32>(cacheEntries.size()) - 1; index >= 0; index--)
+            {
+                if (!cacheEntries[index].cache->isPoolAlive())
+                {
+                    cacheEntries[index].cache->onThreadExit();
+                    cacheEntries[index] = cacheEntries.back();
+                    cacheEntries.pop_back();
+                }
+            }
+            lastEntry = static_cast<int32>(cacheEntries.size());
+            cacheEntries.push_back({ poolID, cache });
+        }
+
+    private:
+
+        struct cache_entry
+        {
+            uint64 poolID = 0;
+            jconcurrent_pool_cache* cache = nullptr;
+        };
+
+        std::vector<cache_entry> cacheEntries;
+        int32 lastEntry = 0;
+    };
+
+    [[nodiscard]] inline jconcurrent_pool_thread_caches& jconcurrent_pool_get_thread_caches()
+    {
+        thread_local jconcurrent_pool_thread_caches ThreadCaches;
+        return ThreadCaches;
+    }
+    [[nodiscard]] inline uint64 jconcurrent_pool_next_id()
+    {
+        static std::atomic<uint64> NextPoolID = 1;
+        return NextPoolID.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+namespace jutils
+{
+    // Thread safe pool. Every thread takes and returns objects through its own cache, caches exchange batches of BatchSize free objects
+    // through a lock-free ring, mutex is locked only to allocate a segment or when the ring is full.
+    // Object could be returned on any thread. Objects that are not returned before the pool is destroyed are not destructed
+    template<typename T, int32 BatchSize = 32>
+    class jconcurrent_pool
+    {
+    public:
+
+        using type = T;
+
+        static constexpr int32 batch_size = jutils::math::max(BatchSize, 1);
+        static constexpr int32 segment_batches_count = 8;
+
+        jconcurrent_pool() : jconcurrent_pool(1024) {}
+        // Batches that don't fit into the ring are kept in a list under the mutex
+        explicit jconcurrent_pool(const int32 ringCapacity) : poolID(jutils_private::jconcurrent_pool_next_id()) { freeBatches.init(ringCapacity); }
+        jconcurrent_pool(const jconcurrent_pool&) = delete;
+        jconcurrent_pool(jconcurrent_pool&&) noexcept = delete;
+        ~jconcurrent_pool() { _destroy(); }
+
+        jconcurrent_pool& operator=(const jconcurrent_pool&) = delete;
+        jconcurrent_pool& operator=(jconcurrent_pool&&) noexcept = delete;
+
+        // Count of allocated objects, used and free
+        [[nodiscard]] int32 getCapacity() const { return objectsCount.load(std::memory_order_relaxed); }
+
+        template<typename... Args>
+        [[nodiscard]] type* getObject(Args&&... args);
+        void returnObject(type* object);
+
+    private:
+
+        union slot_type
+        {
+            struct
+            {
+                slot_type* nextSlot;
+                // Valid for the first slot of a batch
+                slot_type* nextBatch;
+                int32 batchSize;
+            } freeSlot;
+            alignas(type) uint8 data[sizeof(type)];
+        };
+
+        class thread_cache final : public jutils_private::jconcurrent_pool_cache
+        {
+        public:
+            explicit thread_cache(jconcurrent_pool* pool) : ownerPool(pool) {}
+
+            jconcurrent_pool* ownerPool = nullptr;
+            slot_type* slots = nullptr;
+            int32 slotsCount = 0;
+
+        protected:
+
+            virtual void _flush() override
+            {
+                ownerPool->_flushCache(*this);
+            }
+        };
+
+        uint64 poolID = 0;
+        jmpmc_ring<slot_type*> freeBatches;
+        alignas(memory::cache_line_size) std::atomic<int32> overflowBatchesCount = 0;
+        std::atomic<int32> objectsCount = 0;
+
+        std::mutex poolMutex;
+        slot_type* overflowBatches = nullptr;
+        std::vector<slot_type*> segments;
+        std::vector<thread_cache*> threadCaches;
+
+
+        [[nodiscard]] thread_cache* _getThreadCache();
+        void _flushCache(thread_cache& cache);
+        bool _refillCache(thread_cache& cache);
+
+        void _pushBatch(slot_type* batch, int32 size);
+        [[nodiscard]] slot_type* _popBatch();
+        [[nodiscard]] slot_type* _allocateSegment();
+
+        void _destroy();
+    };
+
+    template<typename T, int32 BatchSize>
+    template<typename... Args>
+    typename jconcurrent_pool<T, BatchSize>::type* jconcurrent_pool<T, BatchSize>::getObject(Args&&... args)
+    {
+        thread_cache* cache = _getThreadCache();
+        if ((cache->slotsCount == 0) && !_refillCache(*cache))
+        {
+            return nullptr;
+        }
+
+        slot_type* slot = cache->slots;
+        cache->slots = slot->freeSlot.nextSlot;
+        cache->slotsCount--;
+
+        type* object = reinterpret_cast<type*>(slot->data);
+        memory::construct(object, std::forward<Args>(args)...);
+        return object;
+    }
+    template<typename T, int32 BatchSize>
+    void jconcurrent_pool<T, BatchSize>::returnObject(type* object)
+    {
+        if (object == nullptr)
+        {
+            return;
+        }
+        memory::destruct(object);
+
+        thread_cache* cache = _getThreadCache();
+        slot_type* slot = reinterpret_cast<slot_type*>(object);
+        slot->freeSlot.nextSlot = cache->slots;
+        cache->slots = slot;
+        cache->slotsCount++;
+        if (cache->slotsCount < (batch_size * 2))
+        {
+            return;
+        }
+
+        // Keeps one batch, so alternating get and return on the boundary doesn't hit the ring every time
+        slot_type* batch = cache->slots;
+        slot_type* lastSlot = batch;
+        for (int32 index = 1; index < batch_size; index++)
+        {
+            lastSlot = lastSlot->freeSlot.nextSlot;
+        }
+        cache->slots = lastSlot->freeSlot.nextSlot;
+        cache->slotsCount -= batch_size;
+        lastSlot->freeSlot.nextSlot = nullptr;
+        _pushBatch(batch, batch_size);
+    }
+
+    template<typename T, int32 BatchSize>
+    typename jconcurrent_pool<T, BatchSize>::thread_cache* jconcurrent_pool<T, BatchSize>::_getThreadCache()
+    {
+        jutils_private::jconcurrent_pool_thread_caches& threadCachesList = jutils_private::jconcurrent_pool_get_thread_caches();
+        jutils_private::jconcurrent_pool_cache* cache = threadCachesList.find(poolID);
+        if (cache != nullptr)
+        {
+            return static_cast<thread_cache*>(cache);
+        }
+
+        thread_cache* newCache = new thread_cache(this);
+        {
+            std::lock_guard lock(poolMutex);
+            threadCaches.push_back(newCache);
+        }
+        threadCachesList.add(poolID, newCache);
+        return newCache;
+    }
+    template<typename T, int32 BatchSize>
+    void jconcurrent_pool<T, BatchSize>::_flushCache(thread_cache& cache)
+    {
+        if (cache.slots != nullptr)
+        {
+            _pushBatch(cache.slots, cache.slotsCount);
+            cache.slots = nullptr;
+            cache.slotsCount = 0;
+        }
+    }
+    template<typename T, int32 BatchSize>
+    bool jconcurrent_pool<T, BatchSize>::_refillCache(thread_cache& cache)
+    {
+        slot_type* batch = _popBatch();
+        if (batch == nullptr)
+        {
+            batch = _allocateSegment();
+            if (batch == nullptr)
+            {
+                return false;
+            }
+        }
+        cache.slots = batch;
+        cache.slotsCount = batch->freeSlot.batchSize;
+        return true;
+    }
+
+    template<typename T, int32 BatchSize>
+    void jconcurrent_pool<T, BatchSize>::_pushBatch(slot_type* batch, const int32 size)
+    {
+        batch->freeSlot.batchSize = size;
+        if (freeBatches.push(batch))
+        {
+            return;
+        }
+
+        std::lock_guard lock(poolMutex);
+        batch->freeSlot.nextBatch = overflowBatches;
+        overflowBatches = batch;
+        overflowBatchesCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    template<typename T, int32 BatchSize>
+    typename jconcurrent_pool<T, BatchSize>::slot_type* jconcurrent_pool<T, BatchSize>::_popBatch()
+    {
+        slot_type* batch = nullptr;
+        if (freeBatches.pop(batch))
+        {
+            return batch;
+        }
+        if (overflowBatchesCount.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+
+        std::lock_guard lock(poolMutex);
+        batch = overflowBatches;
+        if (batch != nullptr)
+        {
+            overflowBatches = batch->freeSlot.nextBatch;
+            overflowBatchesCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return batch;
+    }
+    template<typename T, int32 BatchSize>
+    typename jconcurrent_pool<T, BatchSize>::slot_type* jconcurrent_pool<T, BatchSize>::_allocateSegment()
+    {
+        constexpr int32 segmentSize = batch_size * segment_batches_count;
+        slot_type* segment = memory::allocate<slot_type>(segmentSize);
+        if (segment == nullptr)
+        {
+            return nullptr;
+        }
+        {
+            std::lock_guard lock(poolMutex);
+            segments.push_back(segment);
+        }
+        objectsCount.fetch_add(segmentSize, std::memory_order_relaxed);
+
+        for (int32 batchIndex = 0; batchIndex < segment_batches_count; batchIndex++)
+        {
+            slot_type* batch = segment + batchIndex * batch_size;
+            for (int32 index = 0; index < (batch_size - 1); index++)
+            {
+                batch[index].freeSlot.nextSlot = batch + index + 1;
+            }
+            batch[batch_size - 1].freeSlot.nextSlot = nullptr;
+            batch->freeSlot.batchSize = batch_size;
+            if (batchIndex > 0)
+            {
+                _pushBatch(batch, batch_size);
+            }
+        }
+        return segment;
+    }
+
+    template<typename T, int32 BatchSize>
+    void jconcurrent_pool<T, BatchSize>::_destroy()
+    {
+        // Waits for threads that are flushing their caches right now
+        for (const auto& cache : threadCaches)
+        {
+            cache->onPoolDestroyed();
+        }
+        threadCaches.clear();
+
+        freeBatches.init(0);
+        overflowBatches = nullptr;
+        overflowBatchesCount.store(0, std::memory_order_relaxed);
+        for (const auto& segment : segments)
+        {
+            memory::deallocate(segment, batch_size * segment_batches_count);
+        }
+        segments.clear();
+        objectsCount.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,211 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+#include "jplatform.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace jutils::memory
+{
+    // Page sizes are queried once
+    [[nodiscard]] inline std::size_t getPageSize()
+    {
+        static const std::size_t PageSize = jutils_private::jplatform_query_page_size();
+        return PageSize;
+    }
+    // Size of explicit huge pages, 0 if they are not supported
+    [[nodiscard]] inline std::size_t getHugePageSize()
+    {
+        static const std::size_t HugePageSize = jutils_private::jplatform_query_huge_page_size();
+        return HugePageSize;
+    }
+
+    enum class large_block_type : uint8
+    {
+        none,
+        // Settings couldn't be applied, block is allocated by memory::allocate()
+        heap,
+        mapped,
+        // Explicit huge pages (MAP_HUGETLB or MEM_LARGE_PAGES)
+        huge_pages
+    };
+
+    struct large_block_settings
+    {
+        // Asks for transparent huge pages (madvise), block is aligned to the huge page if it's big enough
+        bool transparentHugePages = true;
+        // Tries reserved huge pages first, they need system setup (vm.nr_hugepages or SeLockMemoryPrivilege)
+        bool explicitHugePages = false;
+        // Touches every page, so first accesses don't fault
+        bool prefault = false;
+        // Binds memory to the NUMA node, -1 keeps the default policy
+        int32 numaNode = -1;
+    };
+
+    struct large_block
+    {
+        void* data = nullptr;
+        // Size rounded up to pages
+        std::size_t size = 0;
+        large_block_type type = large_block_type::none;
+        // False if the NUMA node wasn't requested or couldn't be applied
+        bool numaBound = false;
+#if JUTILS_MEMORY_TRACKING
+        // Tag the mapped block is counted for, heap blocks are counted by memory::allocate()
+        int32 trackingTag = default_tracking_tag;
+#endif
+
+        [[nodiscard]] bool isValid() const { return data != nullptr; }
+    };
+}
+
+namespace jutils_private
+{
+    using jutils::int32;
+    using jutils::uint8;
+
+    // Heap fallback is allocated in chunks of the smallest page
+    struct alignas(jplatform_default_page_size) jlarge_memory_heap_chunk
+    {
+        uint8 data[jplatform_default_page_size];
+    };
+
+    [[nodiscard]] constexpr std::size_t jlarge_memory_align(const std::size_t size, const std::size_t alignment)
+    {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+    [[nodiscard]] inline std::size_t jlarge_memory_transparent_huge_page_size()
+    {
+        static const std::size_t HugePageSize = jplatform_query_transparent_huge_page_size();
+        return HugePageSize;
+    }
+
+    inline void jlarge_memory_prefault(void* data, const std::size_t size)
+    {
+        const std::size_t pageSize = jutils::memory::getPageSize();
+        volatile uint8* bytes = static_cast<uint8*>(data);
+        for (std::size_t offset = 0; offset < size; offset += pageSize)
+        {
+            bytes[offset] = 0;
+        }
+    }
+
+    [[nodiscard]] inline jutils::memory::large_block jlarge_memory_allocate_heap(const std::size_t size)
+    {
+        const std::size_t blockSize = jlarge_memory_align(jlarge_memory_align(size, jutils::memory::getPageSize()), sizeof(jlarge_memory_heap_chunk));
+        const std::size_t chunksCount = blockSize / sizeof(jlarge_memory_heap_chunk);
+        if (chunksCount > static_cast<std::size_t>(std::numeric_limits<int32>::max()))
+        {
+            return {};
+        }
+        return { jutils::memory::allocate<jlarge_memory_heap_chunk>(static_cast<int32>(chunksCount)), blockSize, jutils::memory::large_block_type::heap };
+    }
+
+    [[nodiscard]] inline jutils::memory::large_block jlarge_memory_map(const std::size_t size, const jutils::memory::large_block_settings& settings)
+    {
+        const std::size_t hugePageSize = jutils::memory::getHugePageSize();
+        if (settings.explicitHugePages && (hugePageSize > 0))
+        {
+            const std::size_t mapSize = jlarge_memory_align(size, hugePageSize);
+            void* data = jplatform_map(mapSize, true, settings.numaNode);
+            if (data != nullptr)
+            {
+                return { data, mapSize, jutils::memory::large_block_type::huge_pages };
+            }
+        }
+
+        // Huge pages could be used only for aligned ranges, so the mapping is bigger and then trimmed
+        const std::size_t pageSize = jutils::memory::getPageSize();
+        const std::size_t transparentPageSize = settings.transparentHugePages ? jlarge_memory_transparent_huge_page_size() : 0;
+        const bool alignToHugePage = jplatform_can_unmap_partially() && (transparentPageSize > pageSize) && (size >= transparentPageSize);
+        const std::size_t mapSize = jlarge_memory_align(size, alignToHugePage ? transparentPageSize : pageSize);
+        const std::size_t reservedSize = alignToHugePage ? mapSize + transparentPageSize : mapSize;
+        void* reservedData = jplatform_map(reservedSize, false, settings.numaNode);
+        if (reservedData == nullptr)
+        {
+            return {};
+        }
+
+        uint8* data = static_cast<uint8*>(reservedData);
+        if (alignToHugePage)
+        {
+            const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(reservedData);
+            const std::size_t headSize = jlarge_memory_align(address, transparentPageSize) - address;
+            const std::size_t tailSize = reservedSize - headSize - mapSize;
+            if (headSize > 0)
+            {
+                jplatform_unmap(data, headSize);
+            }
+            data += headSize;
+            if (tailSize > 0)
+            {
+                jplatform_unmap(data + mapSize, tailSize);
+            }
+            jplatform_advise_huge_pages(data, mapSize);
+        }
+        return { data, mapSize, jutils::memory::large_block_type::mapped };
+    }
+}
+
+namespace jutils::memory
+{
+    // Allocates whole pages directly from the OS. Falls back to normal pages and then to memory::allocate() if settings couldn't be applied
+    [[nodiscard]] inline large_block allocateLarge(const std::size_t size, const large_block_settings& settings = {})
+    {
+        if (size == 0)
+        {
+            return {};
+        }
+
+        large_block block = jutils_private::jlarge_memory_map(size, settings);
+        if (!block.isValid())
+        {
+            block = jutils_private::jlarge_memory_allocate_heap(size);
+            if (!block.isValid())
+            {
+                return {};
+            }
+        }
+        if ((block.type != large_block_type::heap) && (settings.numaNode >= 0))
+        {
+            block.numaBound = jutils_private::jplatform_bind_numa(block.data, block.size, settings.numaNode);
+        }
+        if (settings.prefault)
+        {
+            jutils_private::jlarge_memory_prefault(block.data, block.size);
+        }
+#if JUTILS_MEMORY_TRACKING
+        if (block.type != large_block_type::heap)
+        {
+            block.trackingTag = getCurrentTrackingTag();
+            jutils_private::jmemory_track_allocation(block.trackingTag, block.size);
+        }
+#endif
+        return block;
+    }
+
+    inline void deallocateLarge(large_block& block)
+    {
+        switch (block.type)
+        {
+        case large_block_type::none:
+            break;
+        case large_block_type::heap:
+            deallocate(static_cast<jutils_private::jlarge_memory_heap_chunk*>(block.data),
+                static_cast<int32>(block.size / sizeof(jutils_private::jlarge_memory_heap_chunk)));
+            break;
+        case large_block_type::mapped:
+        case large_block_type::huge_pages:
+#if JUTILS_MEMORY_TRACKING
+            jutils_private::jmemory_track_deallocation(block.trackingTag, block.size);
+#endif
+            jutils_private::jplatform_unmap(block.data, block.size);
+            break;
+        }
+        block = {};
+    }
+}
@@ -7,8 +7,35 @@
 #include <utility>
 #include <new>
 
+#ifndef JUTILS_MEMORY_TRACKING
+    // Per-tag counters of memory::allocate() and everything built on it, see jmemory_tracking_report.h
+    #define JUTILS_MEMORY_TRACKING 0
+#endif
+
+namespace jutils::memory
+{
+    constexpr std::size_t cache_line_size = 64;
+}
+
+#if JUTILS_MEMORY_TRACKING
+    #include "jmemory_tracking.h"
+#endif
+
 namespace jutils::memory
 {
+#if JUTILS_MEMORY_TRACKING
+    // Sampled call site is the caller of allocate(), so blocks of jpool, jarena, jslab_allocator and other containers
+    // are attributed to their internal allocation functions. Use tracking tags to tell such allocations apart
+    template<typename Type>
+    [[nodiscard]] inline Type* allocate(const int32 size, const std::source_location& location = std::source_location::current())
+    {
+        if (size > 0)
+        {
+            return static_cast<Type*>(jutils_private::jmemory_tracked_allocate(sizeof(Type) * size, alignof(Type), location));
+        }
+        return nullptr;
+    }
+#else
     template<typename Type>
     [[nodiscard]] inline Type* allocate(const int32 size)
     {
@@ -18,13 +45,44 @@ namespace jutils::memory
         }
         return nullptr;
     }
+#endif
+#if JUTILS_MEMORY_TRACKING
+    // Untyped memory for blocks that are too big for int32 counts, alignment should be a power of 2
+    [[nodiscard]] inline void* allocateBytes(const std::size_t size, const std::size_t alignment,
+        const std::source_location& location = std::source_location::current())
+    {
+        return size > 0 ? jutils_private::jmemory_tracked_allocate(size, alignment, location) : nullptr;
+    }
+#else
+    // Untyped memory for blocks that are too big for int32 counts, alignment should be a power of 2
+    [[nodiscard]] inline void* allocateBytes(const std::size_t size, const std::size_t alignment)
+    {
+        return size > 0 ? ::operator new(size, static_cast<std::align_val_t>(alignment)) : nullptr;
+    }
+#endif
 
     template<typename Type>
     inline void deallocate(Type* data, const int32 size)
     {
         if ((data != nullptr) && (size > 0))
         {
+#if JUTILS_MEMORY_TRACKING
+            jutils_private::jmemory_tracked_deallocate(data, alignof(Type));
+#else
             ::operator delete(data, static_cast<std::align_val_t>(alignof(Type)));
+#endif
+        }
+    }
+    // Alignment should be the same as in allocateBytes()
+    inline void deallocateBytes(void* data, const std::size_t alignment)
+    {
+        if (data != nullptr)
+        {
+#if JUTILS_MEMORY_TRACKING
+            jutils_private::jmemory_tracked_deallocate(data, alignment);
+#else
+            ::operator delete(data, static_cast<std::align_val_t>(alignment));
+#endif
         }
     }
 
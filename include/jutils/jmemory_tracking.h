@@ -0,0 +1,256 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "base_types.h"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <source_location>
+#include <vector>
+
+// Included by jmemory.h after memory::cache_line_size, use jmemory.h instead of this header
+
+#if JUTILS_MEMORY_TRACKING && !defined(NDEBUG)
+    // Sampled call sites of memory::allocate()
+    #define JUTILS_MEMORY_TRACKING_CALL_SITES 1
+#else
+    #define JUTILS_MEMORY_TRACKING_CALL_SITES 0
+#endif
+
+namespace jutils::memory
+{
+    constexpr int32 tracking_tags_count = 64;
+    constexpr int32 default_tracking_tag = 0;
+    // Every Nth allocation of a thread records its call site
+    constexpr int32 tracking_sampling_interval = 256;
+
+    struct tracking_call_site
+    {
+        const char* file = nullptr;
+        const char* function = nullptr;
+        uint32 line = 0;
+        int32 tag = default_tracking_tag;
+        uint64 samplesCount = 0;
+        uint64 sampledBytes = 0;
+    };
+}
+
+namespace jutils_private
+{
+    using jutils::int32;
+    using jutils::int64;
+    using jutils::uint64;
+
+    struct jmemory_tag_counters
+    {
+        // Could be negative, memory is often freed by another thread
+        std::atomic<int64> currentBytes = 0;
+        std::atomic<uint64> allocationsCount = 0;
+        std::atomic<uint64> deallocationsCount = 0;
+        std::atomic<uint64> allocatedBytes = 0;
+    };
+    // Counters of one thread, snapshots sum all of them. Block is kept after the thread exits and is reused by the next new thread
+    struct alignas(jutils::memory::cache_line_size) jmemory_thread_counters
+    {
+        jmemory_tag_counters tagCounters[jutils::memory::tracking_tags_count];
+        // Guarded by threadCountersMutex
+        bool used = false;
+    };
+
+    struct jmemory_tracking_state
+    {
+        std::mutex threadCountersMutex;
+        std::vector<jmemory_thread_counters*> threadCounters;
+        // Updated by snapshots, so it's the highest sum of currentBytes they have seen
+        std::atomic<int64> peakBytes[jutils::memory::tracking_tags_count] = {};
+
+        std::atomic<const char*> tagNames[jutils::memory::tracking_tags_count] = {};
+        std::atomic<int32> tagsCount = 1;
+        std::mutex tagsMutex;
+
+        std::mutex callSitesMutex;
+        std::vector<jutils::memory::tracking_call_site> callSites;
+    };
+    // Never destroyed, memory could be freed by static destructors
+    [[nodiscard]] inline jmemory_tracking_state& jmemory_get_tracking_state()
+    {
+        static jmemory_tracking_state* State = []()
+        {
+            jmemory_tracking_state* state = new jmemory_tracking_state();
+            state->tagNames[jutils::memory::default_tracking_tag].store("default", std::memory_order_relaxed);
+            return state;
+        }();
+        return *State;
+    }
+    [[nodiscard]] inline int32& jmemory_current_tag()
+    {
+        thread_local int32 CurrentTag = jutils::memory::default_tracking_tag;
+        return CurrentTag;
+    }
+    [[nodiscard]] inline jmemory_thread_counters* jmemory_acquire_thread_counters()
+    {
+        jmemory_tracking_state& state = jmemory_get_tracking_state();
+        std::lock_guard lock(state.threadCountersMutex);
+        for (jmemory_thread_counters* counters : state.threadCounters)
+        {
+            if (!counters->used)
+            {
+                counters->used = true;
+                return counters;
+            }
+        }
+        jmemory_thread_counters* counters = new jmemory_thread_counters();
+        counters->used = true;
+        state.threadCounters.push_back(counters);
+        return counters;
+    }
+    struct jmemory_thread_counters_owner
+    {
+        jmemory_thread_counters* counters = jmemory_acquire_thread_counters();
+        ~jmemory_thread_counters_owner()
+        {
+            std::lock_guard lock(jmemory_get_tracking_state().threadCountersMutex);
+            counters->used = false;
+        }
+    };
+    // Counters are atomic because snapshots read them, and deallocations in thread_local destructors
+    // could still write to the block after it's released to another thread. Nothing else touches the cache line
+    [[nodiscard]] inline jmemory_thread_counters& jmemory_get_thread_counters()
+    {
+        thread_local jmemory_thread_counters* Counters = nullptr;
+        if (Counters == nullptr)
+        {
+            thread_local jmemory_thread_counters_owner Owner;
+            Counters = Owner.counters;
+        }
+        return *Counters;
+    }
+    inline void jmemory_track_allocation(const int32 tag, const std::size_t size)
+    {
+        jmemory_tag_counters& counters = jmemory_get_thread_counters().tagCounters[tag];
+        counters.allocationsCount.fetch_add(1, std::memory_order_relaxed);
+        counters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        counters.currentBytes.fetch_add(static_cast<int64>(size), std::memory_order_relaxed);
+    }
+    inline void jmemory_track_deallocation(const int32 tag, const std::size_t size)
+    {
+        jmemory_tag_counters& counters = jmemory_get_thread_counters().tagCounters[tag];
+        counters.deallocationsCount.fetch_add(1, std::memory_order_relaxed);
+        counters.currentBytes.fetch_sub(static_cast<int64>(size), std::memory_order_relaxed);
+    }
+
+    inline void jmemory_sample_call_site(const int32 tag, const std::size_t size, const std::source_location& location)
+    {
+        thread_local int32 AllocationsUntilSample = 0;
+        if (AllocationsUntilSample-- > 0)
+        {
+            return;
+        }
+        AllocationsUntilSample = jutils::memory::tracking_sampling_interval - 1;
+
+        constexpr std::size_t maxCallSites = 4096;
+        jmemory_tracking_state& state = jmemory_get_tracking_state();
+        std::lock_guard lock(state.callSitesMutex);
+        for (auto& callSite : state.callSites)
+        {
+            if ((callSite.line == location.line()) && (callSite.tag == tag) && (std::strcmp(callSite.file, location.file_name()) == 0))
+            {
+                callSite.samplesCount++;
+                callSite.sampledBytes += size;
+                return;
+            }
+        }
+        if (state.callSites.size() < maxCallSites)
+        {
+            state.callSites.push_back({ location.file_name(), location.function_name(), location.line(), tag, 1, size });
+        }
+    }
+
+    // Block starts with the header, so deallocation knows the size and the tag
+    struct jmemory_tracking_header
+    {
+        std::size_t size = 0;
+        int32 tag = jutils::memory::default_tracking_tag;
+    };
+    [[nodiscard]] constexpr std::size_t jmemory_tracking_alignment(const std::size_t alignment)
+    {
+        return alignment > sizeof(jmemory_tracking_header) ? alignment : sizeof(jmemory_tracking_header);
+    }
+    [[nodiscard]] inline void* jmemory_tracked_allocate(const std::size_t size, const std::size_t alignment,
+        [[maybe_unused]] const std::source_location& location)
+    {
+        const std::size_t headerSize = jmemory_tracking_alignment(alignment);
+        void* block = ::operator new(headerSize + size, static_cast<std::align_val_t>(headerSize));
+        const int32 tag = jmemory_current_tag();
+        ::new (block) jmemory_tracking_header{ size, tag };
+        jmemory_track_allocation(tag, size);
+#if JUTILS_MEMORY_TRACKING_CALL_SITES
+        jmemory_sample_call_site(tag, size, location);
+#endif
+        return static_cast<jutils::uint8*>(block) + headerSize;
+    }
+    inline void jmemory_tracked_deallocate(void* data, const std::size_t alignment)
+    {
+        const std::size_t headerSize = jmemory_tracking_alignment(alignment);
+        void* block = static_cast<jutils::uint8*>(data) - headerSize;
+        const jmemory_tracking_header* header = static_cast<const jmemory_tracking_header*>(block);
+        jmemory_track_deallocation(header->tag, header->size);
+        ::operator delete(block, static_cast<std::align_val_t>(headerSize));
+    }
+}
+
+namespace jutils::memory
+{
+    // Name should outlive the program. Returns the existing tag for the same name or -1 if there are no free tags
+    inline int32 registerTrackingTag(const char* name)
+    {
+        if (name == nullptr)
+        {
+            return -1;
+        }
+        jutils_private::jmemory_tracking_state& state = jutils_private::jmemory_get_tracking_state();
+        std::lock_guard lock(state.tagsMutex);
+        const int32 tagsCount = state.tagsCount.load(std::memory_order_relaxed);
+        for (int32 tag = 0; tag < tagsCount; tag++)
+        {
+            if (std::strcmp(state.tagNames[tag].load(std::memory_order_relaxed), name) == 0)
+            {
+                return tag;
+            }
+        }
+        if (tagsCount == tracking_tags_count)
+        {
+            return -1;
+        }
+        state.tagNames[tagsCount].store(name, std::memory_order_relaxed);
+        state.tagsCount.store(tagsCount + 1, std::memory_order_release);
+        return tagsCount;
+    }
+    [[nodiscard]] inline int32 getCurrentTrackingTag() { return jutils_private::jmemory_current_tag(); }
+
+    // Allocations of this thread are counted for the tag while the scope is alive, unregistered tags are ignored
+    class tracking_tag_scope
+    {
+    public:
+        explicit tracking_tag_scope(const int32 tag) : previousTag(jutils_private::jmemory_current_tag())
+        {
+            if ((tag >= 0) && (tag < jutils_private::jmemory_get_tracking_state().tagsCount.load(std::memory_order_acquire)))
+            {
+                jutils_private::jmemory_current_tag() = tag;
+            }
+        }
+        tracking_tag_scope(const tracking_tag_scope&) = delete;
+        tracking_tag_scope(tracking_tag_scope&&) noexcept = delete;
+        ~tracking_tag_scope() { jutils_private::jmemory_current_tag() = previousTag; }
+
+        tracking_tag_scope& operator=(const tracking_tag_scope&) = delete;
+        tracking_tag_scope& operator=(tracking_tag_scope&&) noexcept = delete;
+
+    private:
+
+        int32 previousTag = default_tracking_tag;
+    };
+}
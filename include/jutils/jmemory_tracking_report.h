@@ -0,0 +1,148 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+#include "jmemory_tracking.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace jutils::memory
+{
+    struct tracking_tag_stats
+    {
+        const char* name = nullptr;
+        int32 tag = default_tracking_tag;
+        int64 currentBytes = 0;
+        // Highest currentBytes seen by snapshots and dumps, short peaks between them are missed
+        int64 peakBytes = 0;
+        uint64 allocationsCount = 0;
+        uint64 deallocationsCount = 0;
+        uint64 allocatedBytes = 0;
+    };
+    struct tracking_snapshot
+    {
+        int64 timeNs = 0;
+        std::vector<tracking_tag_stats> tags;
+    };
+}
+
+namespace jutils_private
+{
+    struct jmemory_tracking_dump_state
+    {
+        std::mutex dumpMutex;
+        jutils::memory::tracking_snapshot lastDumpSnapshot;
+    };
+    // Never destroyed, same as the tracking state
+    [[nodiscard]] inline jmemory_tracking_dump_state& jmemory_get_tracking_dump_state()
+    {
+        static jmemory_tracking_dump_state* DumpState = new jmemory_tracking_dump_state();
+        return *DumpState;
+    }
+}
+
+namespace jutils::memory
+{
+    // Counters are updated only with JUTILS_MEMORY_TRACKING. Sums of the thread counters are read without stopping the threads
+    [[nodiscard]] inline tracking_snapshot getTrackingSnapshot()
+    {
+        jutils_private::jmemory_tracking_state& state = jutils_private::jmemory_get_tracking_state();
+        tracking_snapshot snapshot;
+        snapshot.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        const int32 tagsCount = state.tagsCount.load(std::memory_order_acquire);
+        snapshot.tags.resize(tagsCount);
+        for (int32 tag = 0; tag < tagsCount; tag++)
+        {
+            snapshot.tags[tag].name = state.tagNames[tag].load(std::memory_order_relaxed);
+            snapshot.tags[tag].tag = tag;
+        }
+        {
+            std::lock_guard lock(state.threadCountersMutex);
+            for (const jutils_private::jmemory_thread_counters* threadCounters : state.threadCounters)
+            {
+                for (int32 tag = 0; tag < tagsCount; tag++)
+                {
+                    const jutils_private::jmemory_tag_counters& counters = threadCounters->tagCounters[tag];
+                    tracking_tag_stats& stats = snapshot.tags[tag];
+                    stats.currentBytes += counters.currentBytes.load(std::memory_order_relaxed);
+                    stats.allocationsCount += counters.allocationsCount.load(std::memory_order_relaxed);
+                    stats.deallocationsCount += counters.deallocationsCount.load(std::memory_order_relaxed);
+                    stats.allocatedBytes += counters.allocatedBytes.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        for (auto& stats : snapshot.tags)
+        {
+            int64 peakBytes = state.peakBytes[stats.tag].load(std::memory_order_relaxed);
+            while ((stats.currentBytes > peakBytes) && !state.peakBytes[stats.tag].compare_exchange_weak(peakBytes, stats.currentBytes, std::memory_order_relaxed))
+            {}
+            stats.peakBytes = std::max(peakBytes, stats.currentBytes);
+        }
+        return snapshot;
+    }
+    // Filled only with JUTILS_MEMORY_TRACKING in debug builds, sorted by sampled bytes
+    [[nodiscard]] inline std::vector<tracking_call_site> getTrackingCallSites()
+    {
+        jutils_private::jmemory_tracking_state& state = jutils_private::jmemory_get_tracking_state();
+        std::vector<tracking_call_site> callSites;
+        {
+            std::lock_guard lock(state.callSitesMutex);
+            callSites = state.callSites;
+        }
+        std::sort(callSites.begin(), callSites.end(), [](const tracking_call_site& callSite1, const tracking_call_site& callSite2)
+        {
+            return callSite1.sampledBytes > callSite2.sampledBytes;
+        });
+        return callSites;
+    }
+
+    // Prints counters of every tag, rates are calculated since the previous dump
+    inline void dumpTracking(std::FILE* file = stdout, const int32 maxCallSites = 16)
+    {
+        jutils_private::jmemory_tracking_dump_state& dumpState = jutils_private::jmemory_get_tracking_dump_state();
+        const tracking_snapshot snapshot = getTrackingSnapshot();
+        tracking_snapshot previousSnapshot;
+        {
+            std::lock_guard lock(dumpState.dumpMutex);
+            previousSnapshot = std::move(dumpState.lastDumpSnapshot);
+            dumpState.lastDumpSnapshot = snapshot;
+        }
+
+        const double seconds = previousSnapshot.timeNs > 0 ? static_cast<double>(snapshot.timeNs - previousSnapshot.timeNs) / 1.0e9 : 0.0;
+        std::fprintf(file, "Memory tracking%s:\n", JUTILS_MEMORY_TRACKING ? "" : " (disabled)");
+        std::fprintf(file, "  %-20s %14s %14s %12s %12s %12s %14s\n", "tag", "current", "peak", "allocations", "live", "allocs/s", "bytes/s");
+        for (const auto& stats : snapshot.tags)
+        {
+            double allocationsRate = 0.0;
+            double bytesRate = 0.0;
+            if ((seconds > 0.0) && (stats.tag < static_cast<int32>(previousSnapshot.tags.size())))
+            {
+                const tracking_tag_stats& previousStats = previousSnapshot.tags[stats.tag];
+                allocationsRate = static_cast<double>(stats.allocationsCount - previousStats.allocationsCount) / seconds;
+                bytesRate = static_cast<double>(stats.allocatedBytes - previousStats.allocatedBytes) / seconds;
+            }
+            std::fprintf(file, "  %-20s %14lld %14lld %12llu %12lld %12.0f %14.0f\n", stats.name,
+                static_cast<long long>(stats.currentBytes), static_cast<long long>(stats.peakBytes), static_cast<unsigned long long>(stats.allocationsCount),
+                static_cast<long long>(stats.allocationsCount - stats.deallocationsCount), allocationsRate, bytesRate);
+        }
+
+        const std::vector<tracking_call_site> callSites = getTrackingCallSites();
+        if (!callSites.empty())
+        {
+            std::fprintf(file, "  Sampled call sites (1 of %d allocations):\n", tracking_sampling_interval);
+            for (int32 index = 0; (index < static_cast<int32>(callSites.size())) && (index < maxCallSites); index++)
+            {
+                const tracking_call_site& callSite = callSites[index];
+                // Tag could be registered after the snapshot was taken
+                const char* tagName = callSite.tag < static_cast<int32>(snapshot.tags.size()) ? snapshot.tags[callSite.tag].name : nullptr;
+                std::fprintf(file, "  %-20s %14llu %8llu  %s:%u %s\n", tagName != nullptr ? tagName : "?",
+                    static_cast<unsigned long long>(callSite.sampledBytes), static_cast<unsigned long long>(callSite.samplesCount),
+                    callSite.file, callSite.line, callSite.function);
+            }
+        }
+    }
+}
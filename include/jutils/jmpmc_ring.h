@@ -0,0 +1,173 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+
+#include <atomic>
+
+namespace jutils
+{
+    // Bounded lock-free multi-producer multi-consumer ring (D. Vyukov), capacity is rounded up to a power of two
+    template<typename T>
+    class jmpmc_ring
+    {
+    public:
+
+        using type = T;
+
+        jmpmc_ring() = default;
+        explicit jmpmc_ring(const int32 capacity) { init(capacity); }
+        jmpmc_ring(const jmpmc_ring&) = delete;
+        jmpmc_ring(jmpmc_ring&&) noexcept = delete;
+        ~jmpmc_ring() { _destroyCells(); }
+
+        jmpmc_ring& operator=(const jmpmc_ring&) = delete;
+        jmpmc_ring& operator=(jmpmc_ring&&) noexcept = delete;
+
+        // Not thread safe, capacity 0 releases the memory
+        void init(int32 capacity);
+
+        [[nodiscard]] int32 getCapacity() const { return static_cast<int32>(cellsMask + 1); }
+        [[nodiscard]] int32 getSize() const;
+        [[nodiscard]] bool isEmpty() const { return getSize() == 0; }
+
+        bool push(const type& value);
+        bool pop(type& outValue);
+
+    private:
+
+        struct cell_type
+        {
+            std::atomic<std::size_t> sequence = 0;
+            type value = type();
+        };
+
+        alignas(memory::cache_line_size) std::atomic<std::size_t> pushPosition = 0;
+        alignas(memory::cache_line_size) std::atomic<std::size_t> popPosition = 0;
+        alignas(memory::cache_line_size) cell_type* cells = nullptr;
+        std::size_t cellsMask = static_cast<std::size_t>(-1);
+
+
+        void _destroyCells();
+    };
+
+    template<typename T>
+    void jmpmc_ring<T>::init(const int32 capacity)
+    {
+        _destroyCells();
+        if (capacity <= 0)
+        {
+            return;
+        }
+
+        int32 cellsCount = 2;
+        while (cellsCount < capacity)
+        {
+            cellsCount <<= 1;
+        }
+        cells = memory::allocate<cell_type>(cellsCount);
+        cellsMask = static_cast<std::size_t>(cellsCount) - 1;
+        for (int32 index = 0; index < cellsCount; index++)
+        {
+            memory::construct(cells + index);
+            cells[index].sequence.store(static_cast<std::size_t>(index), std::memory_order_relaxed);
+        }
+        pushPosition.store(0, std::memory_order_relaxed);
+        popPosition.store(0, std::memory_order_relaxed);
+    }
+    template<typename T>
+    void jmpmc_ring<T>::_destroyCells()
+    {
+        if (cells != nullptr)
+        {
+            const int32 cellsCount = getCapacity();
+            for (int32 index = 0; index < cellsCount; index++)
+            {
+                memory::destruct(cells + index);
+            }
+            memory::deallocate(cells, cellsCount);
+            cells = nullptr;
+            cellsMask = static_cast<std::size_t>(-1);
+        }
+    }
+
+    template<typename T>
+    int32 jmpmc_ring<T>::getSize() const
+    {
+        const std::size_t popIndex = popPosition.load(std::memory_order_relaxed);
+        const std::size_t pushIndex = pushPosition.load(std::memory_order_relaxed);
+        return pushIndex > popIndex ? static_cast<int32>(pushIndex - popIndex) : 0;
+    }
+
+    template<typename T>
+    bool jmpmc_ring<T>::push(const type& value)
+    {
+        if (cells == nullptr)
+        {
+            return false;
+        }
+
+        cell_type* cell;
+        std::size_t position = pushPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = cells + (position & cellsMask);
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+            if (difference == 0)
+            {
+                if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    template<typename T>
+    bool jmpmc_ring<T>::pop(type& outValue)
+    {
+        if (cells == nullptr)
+        {
+            return false;
+        }
+
+        cell_type* cell;
+        std::size_t position = popPosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = cells + (position & cellsMask);
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position + 1);
+            if (difference == 0)
+            {
+                if (popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = popPosition.load(std::memory_order_relaxed);
+            }
+        }
+        outValue = std::move(cell->value);
+        cell->sequence.store(position + cellsMask + 1, std::memory_order_release);
+        return true;
+    }
+}
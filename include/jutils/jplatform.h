@@ -0,0 +1,228 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "base_types.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+// OS calls used by jthread.h and jlarge_memory.h. Nothing here is a part of the public API
+#if defined(_WIN32)
+    // min and max macros of windows.h would break jutils headers, the state of these macros is restored after the include
+    #pragma push_macro("min")
+    #pragma push_macro("max")
+    #include <windows.h>
+    #pragma pop_macro("max")
+    #pragma pop_macro("min")
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace jutils_private
+{
+    using jutils::int32;
+
+    // Smallest page, used when the OS doesn't tell
+    constexpr std::size_t jplatform_default_page_size = 4096;
+
+    [[nodiscard]] inline std::size_t jplatform_query_page_size()
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        return systemInfo.dwPageSize;
+#elif defined(__linux__)
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        return pageSize > 0 ? static_cast<std::size_t>(pageSize) : jplatform_default_page_size;
+#else
+        return jplatform_default_page_size;
+#endif
+    }
+    // Size of explicit huge pages (default hugetlb size or minimum large page), 0 if they are not supported
+    [[nodiscard]] inline std::size_t jplatform_query_huge_page_size()
+    {
+#if defined(_WIN32)
+        return GetLargePageMinimum();
+#elif defined(__linux__)
+        std::FILE* file = std::fopen("/proc/meminfo", "r");
+        if (file == nullptr)
+        {
+            return 0;
+        }
+        std::size_t hugePageSize = 0;
+        char line[128];
+        while (std::fgets(line, sizeof(line), file) != nullptr)
+        {
+            unsigned long long sizeKB = 0;
+            if (std::sscanf(line, "Hugepagesize: %llu kB", &sizeKB) == 1)
+            {
+                hugePageSize = static_cast<std::size_t>(sizeKB) * 1024;
+                break;
+            }
+        }
+        std::fclose(file);
+        return hugePageSize;
+#else
+        return 0;
+#endif
+    }
+    // Size of transparent huge pages, 0 if they are not supported
+    [[nodiscard]] inline std::size_t jplatform_query_transparent_huge_page_size()
+    {
+#if defined(__linux__)
+        std::FILE* file = std::fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+        if (file == nullptr)
+        {
+            return 0;
+        }
+        unsigned long long size = 0;
+        if (std::fscanf(file, "%llu", &size) != 1)
+        {
+            size = 0;
+        }
+        std::fclose(file);
+        return static_cast<std::size_t>(size);
+#else
+        return 0;
+#endif
+    }
+
+    // Returns null on failure or if the OS is not supported. On Linux the NUMA policy is applied by jplatform_bind_numa()
+    [[nodiscard]] inline void* jplatform_map(const std::size_t size, [[maybe_unused]] const bool hugePages, [[maybe_unused]] const int32 numaNode)
+    {
+#if defined(_WIN32)
+        const DWORD flags = MEM_RESERVE | MEM_COMMIT | (hugePages ? MEM_LARGE_PAGES : 0);
+        if (numaNode >= 0)
+        {
+            return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, flags, PAGE_READWRITE, static_cast<DWORD>(numaNode));
+        }
+        return VirtualAlloc(nullptr, size, flags, PAGE_READWRITE);
+#elif defined(__linux__)
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS | (hugePages ? MAP_HUGETLB : 0);
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return data != MAP_FAILED ? data : nullptr;
+#else
+        return nullptr;
+#endif
+    }
+    // Windows can release only the whole mapping, so size is ignored there
+    inline void jplatform_unmap(void* data, [[maybe_unused]] const std::size_t size)
+    {
+#if defined(_WIN32)
+        VirtualFree(data, 0, MEM_RELEASE);
+#elif defined(__linux__)
+        munmap(data, size);
+#endif
+    }
+    [[nodiscard]] constexpr bool jplatform_can_unmap_partially()
+    {
+#if defined(__linux__)
+        return true;
+#else
+        return false;
+#endif
+    }
+    inline void jplatform_advise_huge_pages([[maybe_unused]] void* data, [[maybe_unused]] const std::size_t size)
+    {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(data, size, MADV_HUGEPAGE);
+#endif
+    }
+    // Returns true if pages of the range are bound to the node. Windows applies the node in jplatform_map()
+    [[nodiscard]] inline bool jplatform_bind_numa([[maybe_unused]] void* data, [[maybe_unused]] const std::size_t size, const int32 numaNode)
+    {
+#if defined(_WIN32)
+        return numaNode >= 0;
+#elif defined(__linux__)
+        // mbind() without libnuma, MPOL_BIND is 2
+        constexpr int32 bitsPerMask = static_cast<int32>(sizeof(unsigned long) * 8);
+        constexpr int32 masksCount = 16;
+        if ((numaNode < 0) || (numaNode >= (bitsPerMask * masksCount)))
+        {
+            return false;
+        }
+        unsigned long nodeMask[masksCount] = {};
+        nodeMask[numaNode / bitsPerMask] = 1ul << (numaNode % bitsPerMask);
+        return syscall(SYS_mbind, data, size, 2, nodeMask, static_cast<unsigned long>(bitsPerMask * masksCount + 1), 0u) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // CPUs the calling thread is allowed to run on, false if the OS doesn't tell
+    inline bool jplatform_get_thread_cpus(std::vector<int32>& outCpus)
+    {
+        outCpus.clear();
+#if defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) != 0)
+        {
+            return false;
+        }
+        for (int32 cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &cpuSet))
+            {
+                outCpus.push_back(cpu);
+            }
+        }
+        return !outCpus.empty();
+#else
+        return false;
+#endif
+    }
+    inline bool jplatform_set_thread_cpus(const std::vector<int32>& cpus)
+    {
+#if defined(_WIN32)
+        DWORD_PTR mask = 0;
+        for (const int32 cpu : cpus)
+        {
+            if ((cpu >= 0) && (cpu < static_cast<int32>(sizeof(DWORD_PTR) * 8)))
+            {
+                mask |= static_cast<DWORD_PTR>(1) << cpu;
+            }
+        }
+        return (mask != 0) && (SetThreadAffinityMask(GetCurrentThread(), mask) != 0);
+#elif defined(__linux__)
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (const int32 cpu : cpus)
+        {
+            if ((cpu >= 0) && (cpu < CPU_SETSIZE))
+            {
+                CPU_SET(cpu, &cpuSet);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+        return false;
+#endif
+    }
+    // Name could be truncated, Linux allows only 15 characters
+    inline bool jplatform_set_thread_name([[maybe_unused]] const char* name)
+    {
+#if defined(_WIN32)
+        wchar_t wideName[64];
+        int32 index = 0;
+        for (; (index < 63) && (name[index] != '\0'); index++)
+        {
+            wideName[index] = static_cast<wchar_t>(static_cast<unsigned char>(name[index]));
+        }
+        wideName[index] = L'\0';
+        return SUCCEEDED(SetThreadDescription(GetCurrentThread(), wideName));
+#elif defined(__linux__)
+        char shortName[16];
+        std::snprintf(shortName, sizeof(shortName), "%s", name);
+        return pthread_setname_np(pthread_self(), shortName) == 0;
+#else
+        return false;
+#endif
+    }
+}
@@ -4,11 +4,13 @@
 
 #include "jmemory.h"
 #include "math/math.h"
-#include <deque>
+#include <bit>
+#include <vector>
 
 namespace jutils
 {
-    template<typename T, uint8 SegmentSize = 1>
+    // SegmentSize is the default size of segments, it could be changed at runtime
+    template<typename T, int32 SegmentSize = 1>
     class jpool
     {
     public:
@@ -16,98 +18,270 @@ namespace jutils
         using type = T;
 
         jpool() = default;
+        // Every next segment is twice bigger until it reaches maxSegmentSize
+        explicit jpool(const int32 segmentSize, const int32 maxSize = 0) { setSegmentSize(segmentSize, maxSize); }
         jpool(const jpool&) = delete;
-        jpool(jpool&& pool) noexcept = default;
+        jpool(jpool&& pool) noexcept
+            : objectsPool(std::move(pool.objectsPool)), firstFreeSegment(pool.firstFreeSegment), objectsCount(pool.objectsCount)
+            , firstSegmentSize(pool.firstSegmentSize), lastSegmentSize(pool.lastSegmentSize), maxSegmentSize(pool.maxSegmentSize)
+        {
+            pool.objectsPool.clear();
+            pool.firstFreeSegment = 0;
+            pool.objectsCount = 0;
+            pool.lastSegmentSize = 0;
+        }
         ~jpool() { clear(); }
 
         jpool& operator=(const jpool&) = delete;
-        jpool& operator=(jpool&& pool) noexcept = default;
+        jpool& operator=(jpool&& pool) noexcept
+        {
+            if (this != &pool)
+            {
+                clear();
+                objectsPool = std::move(pool.objectsPool);
+                firstFreeSegment = pool.firstFreeSegment;
+                objectsCount = pool.objectsCount;
+                firstSegmentSize = pool.firstSegmentSize;
+                lastSegmentSize = pool.lastSegmentSize;
+                maxSegmentSize = pool.maxSegmentSize;
+                pool.objectsPool.clear();
+                pool.firstFreeSegment = 0;
+                pool.objectsCount = 0;
+                pool.lastSegmentSize = 0;
+            }
+            return *this;
+        }
+
+        // Count of objects in all segments, used and unused
+        [[nodiscard]] int32 getCapacity() const { return objectsCount; }
+        [[nodiscard]] int32 getSegmentsCount() const { return static_cast<int32>(objectsPool.size()); }
+        // Applied to the next allocated segments, growth starts again from segmentSize
+        void setSegmentSize(int32 segmentSize, int32 maxSize = 0);
 
         template<typename... Args>
         [[nodiscard]] type* getObject(Args&&... args);
         void returnObject(type* object);
         void clear();
+        // Releases segments without used objects
+        void trim();
+
+        // Calls function(object) for every object that is not returned, in the order of segments
+        template<typename Func>
+        void forEachLive(Func&& function);
+        template<typename Func>
+        void forEachLive(Func&& function) const;
         
     private:
 
-        static constexpr uint8 segment_size = jutils::math::max(SegmentSize, 1);
-        struct alignas(type) internal_type
+        struct slot_type
         {
-            uint8 data[sizeof(type)];
+            alignas(type) uint8 data[sizeof(type)];
         };
+        // Bit of usedMask is set for every used slot, bits after the last slot are always set
         struct segment_type
         {
-            internal_type data[segment_size];
+            slot_type* data = nullptr;
+            uint64* usedMask = nullptr;
+            int32 size = 0;
+            int32 usedCount = 0;
+
+            [[nodiscard]] int32 getMaskSize() const { return (size + 63) / 64; }
+            [[nodiscard]] type* getObject(const int32 index) const { return reinterpret_cast<type*>(data[index].data); }
         };
 
-        std::deque<segment_type> objectsPool;
-        std::deque<type*> unusedObjects;
+        std::vector<segment_type> objectsPool;
+        // Segments before it have no unused slots
+        int32 firstFreeSegment = 0;
+        int32 objectsCount = 0;
+
+        int32 firstSegmentSize = jutils::math::max(SegmentSize, 1);
+        int32 lastSegmentSize = 0;
+        int32 maxSegmentSize = jutils::math::max(SegmentSize, 1);
 
         
+        void _addSegment();
+        void _freeSegment(const segment_type& segment);
+        [[nodiscard]] int32 _findSegment(const type* object) const;
+        // Calls function(slotIndex) for every used slot of the segment
+        template<typename Func>
+        static void _forEachUsedSlot(const segment_type& segment, Func&& function);
         template<typename... Args>
         void _initPoolObject(type* object, Args&&... args);
         void _clearPoolObject(type* object);
     };
     
-    template<typename T, uint8 SegmentSize>
+    template<typename T, int32 SegmentSize>
     template<typename... Args>
     typename jpool<T, SegmentSize>::type* jpool<T, SegmentSize>::getObject(Args&&... args)
     {
-        type* object;
-        if (!unusedObjects.empty())
+        const int32 segmentsCount = getSegmentsCount();
+        while ((firstFreeSegment < segmentsCount) && (objectsPool[firstFreeSegment].usedCount == objectsPool[firstFreeSegment].size))
         {
-            object = unusedObjects.front();
-            unusedObjects.pop_front();
+            firstFreeSegment++;
         }
-        else
+        if (firstFreeSegment == segmentsCount)
         {
-            auto& segment = objectsPool.emplace_back()->data;
-            object = reinterpret_cast<type*>(segment[0].data);
-            if constexpr (segment_size > 1)
-            {
-                for (uint8 index = 1; index < segment_size; index++)
-                {
-                    unusedObjects.push_back(reinterpret_cast<type*>(segment[index].data));
-                }
-            }
+            _addSegment();
         }
+
+        segment_type& segment = objectsPool[firstFreeSegment];
+        int32 maskIndex = 0;
+        while (segment.usedMask[maskIndex] == ~static_cast<uint64>(0))
+        {
+            maskIndex++;
+        }
+        const int32 slotIndex = maskIndex * 64 + std::countr_one(segment.usedMask[maskIndex]);
+        type* object = segment.getObject(slotIndex);
         this->_initPoolObject(object, std::forward<Args>(args)...);
+        segment.usedMask[maskIndex] |= static_cast<uint64>(1) << (slotIndex % 64);
+        segment.usedCount++;
         return object;
     }
-    template<typename T, uint8 SegmentSize>
+    template<typename T, int32 SegmentSize>
     void jpool<T, SegmentSize>::returnObject(type* object)
     {
-        if (object != nullptr)
+        const int32 segmentIndex = object != nullptr ? _findSegment(object) : -1;
+        if (segmentIndex >= 0)
         {
             this->_clearPoolObject(object);
-            unusedObjects.push_back(object);
+            segment_type& segment = objectsPool[segmentIndex];
+            const int32 slotIndex = static_cast<int32>(reinterpret_cast<slot_type*>(object) - segment.data);
+            segment.usedMask[slotIndex / 64] &= ~(static_cast<uint64>(1) << (slotIndex % 64));
+            segment.usedCount--;
+            firstFreeSegment = jutils::math::min(firstFreeSegment, segmentIndex);
         }
     }
-    template<typename T, uint8 SegmentSize>
+    template<typename T, int32 SegmentSize>
     void jpool<T, SegmentSize>::clear()
     {
-        for (auto& segment : objectsPool)
+        for (const auto& segment : objectsPool)
+        {
+            _forEachUsedSlot(segment, [this, &segment](const int32 slotIndex) { this->_clearPoolObject(segment.getObject(slotIndex)); });
+            _freeSegment(segment);
+        }
+        objectsPool.clear();
+        firstFreeSegment = 0;
+        objectsCount = 0;
+        lastSegmentSize = 0;
+    }
+    template<typename T, int32 SegmentSize>
+    void jpool<T, SegmentSize>::trim()
+    {
+        int32 segmentsCount = 0;
+        for (const auto& segment : objectsPool)
         {
-            for (auto& wrapper : segment.data)
+            if (segment.usedCount > 0)
             {
-                type* object = reinterpret_cast<type*>(wrapper.data);
-                if (std::find(unusedObjects.begin(), unusedObjects.end(), object) == unusedObjects.end())
+                objectsPool[segmentsCount++] = segment;
+            }
+            else
+            {
+                objectsCount -= segment.size;
+                _freeSegment(segment);
+            }
+        }
+        objectsPool.resize(segmentsCount);
+        objectsPool.shrink_to_fit();
+        firstFreeSegment = 0;
+        // Growth continues from the last segment that is left
+        lastSegmentSize = segmentsCount > 0 ? objectsPool.back().size : 0;
+    }
+
+    template<typename T, int32 SegmentSize>
+    void jpool<T, SegmentSize>::setSegmentSize(const int32 segmentSize, const int32 maxSize)
+    {
+        firstSegmentSize = jutils::math::max(segmentSize, 1);
+        maxSegmentSize = jutils::math::max(maxSize, firstSegmentSize);
+        lastSegmentSize = 0;
+    }
+    template<typename T, int32 SegmentSize>
+    void jpool<T, SegmentSize>::_addSegment()
+    {
+        const int32 segmentSize = lastSegmentSize > 0 ? jutils::math::min(lastSegmentSize * 2, maxSegmentSize) : firstSegmentSize;
+        segment_type& segment = objectsPool.emplace_back();
+        segment.data = jutils::memory::allocate<slot_type>(segmentSize);
+        segment.size = segmentSize;
+        const int32 maskSize = segment.getMaskSize();
+        segment.usedMask = jutils::memory::allocate<uint64>(maskSize);
+        for (int32 maskIndex = 0; maskIndex < maskSize; maskIndex++)
+        {
+            segment.usedMask[maskIndex] = 0;
+        }
+        if ((segmentSize % 64) != 0)
+        {
+            segment.usedMask[maskSize - 1] = ~static_cast<uint64>(0) << (segmentSize % 64);
+        }
+        objectsCount += segmentSize;
+        lastSegmentSize = segmentSize;
+    }
+    template<typename T, int32 SegmentSize>
+    void jpool<T, SegmentSize>::_freeSegment(const segment_type& segment)
+    {
+        jutils::memory::deallocate(segment.usedMask, segment.getMaskSize());
+        jutils::memory::deallocate(segment.data, segment.size);
+    }
+    template<typename T, int32 SegmentSize>
+    int32 jpool<T, SegmentSize>::_findSegment(const type* object) const
+    {
+        // Later segments are bigger, so they are checked first
+        const slot_type* slot = reinterpret_cast<const slot_type*>(object);
+        for (int32 segmentIndex = getSegmentsCount() - 1; segmentIndex >= 0; segmentIndex--)
+        {
+            const segment_type& segment = objectsPool[segmentIndex];
+            if ((slot >= segment.data) && (slot < (segment.data + segment.size)))
+            {
+                return segmentIndex;
+            }
+        }
+        return -1;
+    }
+    template<typename T, int32 SegmentSize>
+    template<typename Func>
+    void jpool<T, SegmentSize>::_forEachUsedSlot(const segment_type& segment, Func&& function)
+    {
+        const int32 maskSize = segment.getMaskSize();
+        for (int32 maskIndex = 0; maskIndex < maskSize; maskIndex++)
+        {
+            uint64 mask = segment.usedMask[maskIndex];
+            while (mask != 0)
+            {
+                const int32 slotIndex = maskIndex * 64 + std::countr_zero(mask);
+                if (slotIndex >= segment.size)
                 {
-                    this->_clearPoolObject(object);
+                    break;
                 }
+                function(slotIndex);
+                mask &= mask - 1;
             }
         }
-        unusedObjects.clear();
-        objectsPool.clear();
     }
 
-    template <typename T, uint8 SegmentSize>
+    template<typename T, int32 SegmentSize>
+    template<typename Func>
+    void jpool<T, SegmentSize>::forEachLive(Func&& function)
+    {
+        for (const auto& segment : objectsPool)
+        {
+            _forEachUsedSlot(segment, [&function, &segment](const int32 slotIndex) { function(*segment.getObject(slotIndex)); });
+        }
+    }
+    template<typename T, int32 SegmentSize>
+    template<typename Func>
+    void jpool<T, SegmentSize>::forEachLive(Func&& function) const
+    {
+        for (const auto& segment : objectsPool)
+        {
+            _forEachUsedSlot(segment, [&function, &segment](const int32 slotIndex) { function(*static_cast<const type*>(segment.getObject(slotIndex))); });
+        }
+    }
+
+    template <typename T, int32 SegmentSize>
     template<typename... Args>
     void jpool<T, SegmentSize>::_initPoolObject(type* object, Args&&... args)
     {
         jutils::memory::construct(object, std::forward<Args>(args)...);
     }
-    template <typename T, uint8 SegmentSize>
+    template <typename T, int32 SegmentSize>
     void jpool<T, SegmentSize>::_clearPoolObject(type* object)
     {
         jutils::memory::destruct(object);
@@ -0,0 +1,358 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+
+#include <cstddef>
+#include <initializer_list>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <utility>
+
+namespace jutils_private
+{
+    using jutils::int32;
+    using jutils::uint8;
+
+    constexpr int32 jslab_classes_count = 20;
+    constexpr std::size_t jslab_max_size = 2048;
+    constexpr std::size_t jslab_alignment = 16;
+    constexpr std::size_t jslab_slab_size = 64 * 1024;
+    constexpr int32 jslab_magazine_capacity = 64;
+
+    // 16 bytes step up to 128, 64 bytes step up to 512, 256 bytes step up to 2048
+    [[nodiscard]] constexpr int32 jslab_class_index(const std::size_t size)
+    {
+        if (size <= 128)
+        {
+            return static_cast<int32>((size + 15) / 16) - 1;
+        }
+        if (size <= 512)
+        {
+            return 7 + static_cast<int32>((size - 128 + 63) / 64);
+        }
+        return 13 + static_cast<int32>((size - 512 + 255) / 256);
+    }
+    [[nodiscard]] constexpr std::size_t jslab_class_size(const int32 classIndex)
+    {
+        if (classIndex < 8)
+        {
+            return static_cast<std::size_t>(classIndex + 1) * 16;
+        }
+        if (classIndex < 14)
+        {
+            return 128 + static_cast<std::size_t>(classIndex - 7) * 64;
+        }
+        return 512 + static_cast<std::size_t>(classIndex - 13) * 256;
+    }
+
+    struct jslab_magazine
+    {
+        jslab_magazine* nextMagazine = nullptr;
+        int32 count = 0;
+        void* objects[jslab_magazine_capacity];
+    };
+    // Two magazines per class, so alternating allocate and deallocate on the boundary doesn't go to the depot every time
+    struct jslab_cache
+    {
+        jslab_magazine* loadedMagazines[jslab_classes_count] = {};
+        jslab_magazine* previousMagazines[jslab_classes_count] = {};
+    };
+
+    // Magazines of one size class shared by all threads
+    class jslab_depot
+    {
+    public:
+        jslab_depot() = default;
+        jslab_depot(const jslab_depot&) = delete;
+        jslab_depot(jslab_depot&&) noexcept = delete;
+        ~jslab_depot() = default;
+
+        jslab_depot& operator=(const jslab_depot&) = delete;
+        jslab_depot& operator=(jslab_depot&&) noexcept = delete;
+
+        void init(const std::size_t size) { objectSize = size; }
+
+        // Takes an empty magazine (could be null), returns not empty one
+        [[nodiscard]] jslab_magazine* exchangeEmpty(jslab_magazine* emptyMagazine)
+        {
+            std::lock_guard lock(depotMutex);
+            _push(emptyMagazines, emptyMagazine);
+            jslab_magazine* magazine = _pop(fullMagazines);
+            return magazine != nullptr ? magazine : _createFullMagazine();
+        }
+        // Takes a full magazine (could be null), returns empty one
+        [[nodiscard]] jslab_magazine* exchangeFull(jslab_magazine* fullMagazine)
+        {
+            std::lock_guard lock(depotMutex);
+            _push(fullMagazines, fullMagazine);
+            return _createEmptyMagazine();
+        }
+        void returnMagazine(jslab_magazine* magazine)
+        {
+            std::lock_guard lock(depotMutex);
+            _push(magazine->count > 0 ? fullMagazines : emptyMagazines, magazine);
+        }
+
+    private:
+
+        struct alignas(jutils::memory::cache_line_size) slab_type
+        {
+            uint8 data[jslab_slab_size];
+        };
+
+        std::mutex depotMutex;
+        std::size_t objectSize = 0;
+        // Full list also keeps partially filled magazines returned by exited threads
+        jslab_magazine* fullMagazines = nullptr;
+        jslab_magazine* emptyMagazines = nullptr;
+        uint8* slabPosition = nullptr;
+        uint8* slabEnd = nullptr;
+
+
+        static void _push(jslab_magazine*& list, jslab_magazine* magazine)
+        {
+            if (magazine != nullptr)
+            {
+                magazine->nextMagazine = list;
+                list = magazine;
+            }
+        }
+        [[nodiscard]] static jslab_magazine* _pop(jslab_magazine*& list)
+        {
+            jslab_magazine* magazine = list;
+            if (magazine != nullptr)
+            {
+                list = magazine->nextMagazine;
+                magazine->nextMagazine = nullptr;
+            }
+            return magazine;
+        }
+
+        [[nodiscard]] jslab_magazine* _createEmptyMagazine()
+        {
+            jslab_magazine* magazine = _pop(emptyMagazines);
+            if (magazine == nullptr)
+            {
+                magazine = jutils::memory::allocate<jslab_magazine>(1);
+                jutils::memory::construct(magazine);
+            }
+            return magazine;
+        }
+        [[nodiscard]] jslab_magazine* _createFullMagazine()
+        {
+            jslab_magazine* magazine = _createEmptyMagazine();
+            while (magazine->count < jslab_magazine_capacity)
+            {
+                if (static_cast<std::size_t>(slabEnd - slabPosition) < objectSize)
+                {
+                    // Slabs are never released, freed objects are reused by the same size class
+                    slabPosition = jutils::memory::allocate<slab_type>(1)->data;
+                    slabEnd = slabPosition + jslab_slab_size;
+                }
+                magazine->objects[magazine->count++] = slabPosition;
+                slabPosition += objectSize;
+            }
+            return magazine;
+        }
+    };
+
+    class jslab_heap
+    {
+    public:
+
+        // Never destroyed, so threads that exit after static destructors could still return their magazines
+        [[nodiscard]] static jslab_heap& get()
+        {
+            static jslab_heap* Heap = new jslab_heap();
+            return *Heap;
+        }
+
+        // Used by threads whose cache is already destroyed
+        std::mutex sharedCacheMutex;
+        jslab_cache sharedCache;
+
+        [[nodiscard]] void* allocate(const int32 classIndex, jslab_cache& cache)
+        {
+            jslab_magazine*& loadedMagazine = cache.loadedMagazines[classIndex];
+            jslab_magazine*& previousMagazine = cache.previousMagazines[classIndex];
+            if ((loadedMagazine == nullptr) || (loadedMagazine->count == 0))
+            {
+                if ((previousMagazine != nullptr) && (previousMagazine->count > 0))
+                {
+                    std::swap(loadedMagazine, previousMagazine);
+                }
+                else
+                {
+                    jslab_magazine* fullMagazine = depots[classIndex].exchangeEmpty(previousMagazine);
+                    previousMagazine = loadedMagazine;
+                    loadedMagazine = fullMagazine;
+                }
+            }
+            return loadedMagazine->objects[--loadedMagazine->count];
+        }
+        void deallocate(const int32 classIndex, void* data, jslab_cache& cache)
+        {
+            jslab_magazine*& loadedMagazine = cache.loadedMagazines[classIndex];
+            jslab_magazine*& previousMagazine = cache.previousMagazines[classIndex];
+            if ((loadedMagazine == nullptr) || (loadedMagazine->count == jslab_magazine_capacity))
+            {
+                if ((previousMagazine != nullptr) && (previousMagazine->count < jslab_magazine_capacity))
+                {
+                    std::swap(loadedMagazine, previousMagazine);
+                }
+                else
+                {
+                    jslab_magazine* emptyMagazine = depots[classIndex].exchangeFull(previousMagazine);
+                    previousMagazine = loadedMagazine;
+                    loadedMagazine = emptyMagazine;
+                }
+            }
+            loadedMagazine->objects[loadedMagazine->count++] = data;
+        }
+        void flush(jslab_cache& cache)
+        {
+            for (int32 classIndex = 0; classIndex < jslab_classes_count; classIndex++)
+            {
+                for (jslab_magazine** magazine : { &cache.loadedMagazines[classIndex], &cache.previousMagazines[classIndex] })
+                {
+                    if (*magazine != nullptr)
+                    {
+                        depots[classIndex].returnMagazine(*magazine);
+                        *magazine = nullptr;
+                    }
+                }
+            }
+        }
+
+    private:
+
+        jslab_depot depots[jslab_classes_count];
+
+
+        jslab_heap()
+        {
+            for (int32 classIndex = 0; classIndex < jslab_classes_count; classIndex++)
+            {
+                depots[classIndex].init(jslab_class_size(classIndex));
+            }
+        }
+    };
+
+    struct jslab_thread_cache
+    {
+        static inline thread_local bool Destroyed = false;
+
+        jslab_cache cache;
+
+        ~jslab_thread_cache()
+        {
+            jslab_heap::get().flush(cache);
+            Destroyed = true;
+        }
+    };
+    // Null after the cache of this thread is destroyed
+    [[nodiscard]] inline jslab_thread_cache* jslab_get_thread_cache()
+    {
+        if (jslab_thread_cache::Destroyed)
+        {
+            return nullptr;
+        }
+        thread_local jslab_thread_cache ThreadCache;
+        return &ThreadCache;
+    }
+
+    [[nodiscard]] inline void* jslab_allocate(const std::size_t size)
+    {
+        jslab_heap& heap = jslab_heap::get();
+        const int32 classIndex = jslab_class_index(size);
+        jslab_thread_cache* threadCache = jslab_get_thread_cache();
+        if (threadCache != nullptr)
+        {
+            return heap.allocate(classIndex, threadCache->cache);
+        }
+        std::lock_guard lock(heap.sharedCacheMutex);
+        return heap.allocate(classIndex, heap.sharedCache);
+    }
+    inline void jslab_deallocate(void* data, const std::size_t size)
+    {
+        jslab_heap& heap = jslab_heap::get();
+        const int32 classIndex = jslab_class_index(size);
+        jslab_thread_cache* threadCache = jslab_get_thread_cache();
+        if (threadCache != nullptr)
+        {
+            heap.deallocate(classIndex, data, threadCache->cache);
+            return;
+        }
+        std::lock_guard lock(heap.sharedCacheMutex);
+        heap.deallocate(classIndex, data, heap.sharedCache);
+    }
+}
+
+namespace jutils::memory::slab
+{
+    // Same as memory::allocate(), but small blocks come from size class slabs through a cache of the calling thread.
+    // Blocks bigger than 2048 bytes or aligned more than 16 bytes go to memory::allocate()
+    template<typename Type>
+    [[nodiscard]] inline Type* allocate(const int32 size)
+    {
+        if (size <= 0)
+        {
+            return nullptr;
+        }
+        const std::size_t bytes = sizeof(Type) * static_cast<std::size_t>(size);
+        if ((alignof(Type) > jutils_private::jslab_alignment) || (bytes > jutils_private::jslab_max_size))
+        {
+            return memory::allocate<Type>(size);
+        }
+        return static_cast<Type*>(jutils_private::jslab_allocate(bytes));
+    }
+
+    // Size should be the same as in allocate(), block could be deallocated on any thread
+    template<typename Type>
+    inline void deallocate(Type* data, const int32 size)
+    {
+        if ((data == nullptr) || (size <= 0))
+        {
+            return;
+        }
+        const std::size_t bytes = sizeof(Type) * static_cast<std::size_t>(size);
+        if ((alignof(Type) > jutils_private::jslab_alignment) || (bytes > jutils_private::jslab_max_size))
+        {
+            memory::deallocate(data, size);
+            return;
+        }
+        jutils_private::jslab_deallocate(data, bytes);
+    }
+}
+
+namespace jutils
+{
+    // STL allocator on top of memory::slab
+    template<typename T>
+    class jslab_allocator
+    {
+    public:
+
+        using value_type = T;
+
+        jslab_allocator() = default;
+        template<typename U>
+        jslab_allocator(const jslab_allocator<U>&) noexcept {}
+
+        [[nodiscard]] T* allocate(const std::size_t count)
+        {
+            if (count > static_cast<std::size_t>(std::numeric_limits<int32>::max()))
+            {
+                throw std::bad_array_new_length();
+            }
+            return memory::slab::allocate<T>(static_cast<int32>(count));
+        }
+        void deallocate(T* data, const std::size_t count) { memory::slab::deallocate(data, static_cast<int32>(count)); }
+
+        template<typename U>
+        [[nodiscard]] bool operator==(const jslab_allocator<U>&) const noexcept { return true; }
+    };
+}
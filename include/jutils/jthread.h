@@ -0,0 +1,114 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jplatform.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace jutils_private
+{
+    using jutils::int32;
+
+#if defined(__linux__)
+    // Parses lists like "0-3,8,10-11" from sysfs
+    inline bool jthread_read_cpu_list(const char* path, std::vector<int32>& outList)
+    {
+        std::FILE* file = std::fopen(path, "r");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        outList.clear();
+        int32 rangeBegin = 0;
+        while (std::fscanf(file, "%d", &rangeBegin) == 1)
+        {
+            int32 rangeEnd = rangeBegin;
+            const int separator = std::fgetc(file);
+            if ((separator == '-') && (std::fscanf(file, "%d", &rangeEnd) == 1))
+            {
+                std::fgetc(file);
+            }
+            for (int32 value = rangeBegin; value <= rangeEnd; value++)
+            {
+                outList.push_back(value);
+            }
+        }
+        std::fclose(file);
+        return true;
+    }
+#endif
+}
+
+namespace jutils::thread
+{
+    // CPUs the process is allowed to run on
+    [[nodiscard]] inline std::vector<int32> getAvailableCpus()
+    {
+        std::vector<int32> cpus;
+        if (!jutils_private::jplatform_get_thread_cpus(cpus))
+        {
+            const int32 cpusCount = static_cast<int32>(std::max(std::thread::hardware_concurrency(), 1u));
+            for (int32 cpu = 0; cpu < cpusCount; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    // Available CPUs of each NUMA node, nodes without available CPUs are skipped. If there is no NUMA info it's one node with all CPUs
+    [[nodiscard]] inline std::vector<std::vector<int32>> getNumaNodes()
+    {
+        const std::vector<int32> availableCpus = getAvailableCpus();
+        std::vector<std::vector<int32>> nodes;
+#if defined(__linux__)
+        std::vector<int32> nodeIDs;
+        if (jutils_private::jthread_read_cpu_list("/sys/devices/system/node/online", nodeIDs))
+        {
+            char path[64];
+            std::vector<int32> nodeCpus;
+            for (const int32 nodeID : nodeIDs)
+            {
+                std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodeID);
+                if (!jutils_private::jthread_read_cpu_list(path, nodeCpus))
+                {
+                    continue;
+                }
+                std::vector<int32> cpus;
+                for (const int32 cpu : nodeCpus)
+                {
+                    if (std::find(availableCpus.begin(), availableCpus.end(), cpu) != availableCpus.end())
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty())
+                {
+                    nodes.push_back(std::move(cpus));
+                }
+            }
+        }
+#endif
+        if (nodes.empty())
+        {
+            nodes.push_back(availableCpus);
+        }
+        return nodes;
+    }
+
+    inline bool setCurrentThreadAffinity(const std::vector<int32>& cpus)
+    {
+        return !cpus.empty() && jutils_private::jplatform_set_thread_cpus(cpus);
+    }
+
+    // Name could be truncated, Linux allows only 15 characters
+    inline bool setCurrentThreadName(const char* name)
+    {
+        return (name != nullptr) && jutils_private::jplatform_set_thread_name(name);
+    }
+}
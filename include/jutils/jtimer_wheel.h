@@ -0,0 +1,365 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "base_types.h"
+#include "math/math.h"
+
+#include <limits>
+#include <vector>
+
+namespace jutils
+{
+    struct jtimer_handle
+    {
+        int32 index = -1;
+        uint32 generation = 0;
+
+        [[nodiscard]] bool isValid() const { return index >= 0; }
+        [[nodiscard]] bool operator==(const jtimer_handle&) const = default;
+    };
+
+    // Hierarchical timer wheel, insert and remove are O(1). Entries live until destroy(), so an expired entry could be scheduled again.
+    // Not thread safe
+    template<typename T>
+    class jtimer_wheel
+    {
+    public:
+
+        using type = T;
+
+        static constexpr int32 slot_bits = 6;
+        static constexpr int32 slots_count = 1 << slot_bits;
+        static constexpr int32 levels_count = 4;
+        static constexpr int64 invalid_tick = std::numeric_limits<int64>::max();
+
+        jtimer_wheel() { _resetSlots(); }
+        jtimer_wheel(const jtimer_wheel&) = delete;
+        jtimer_wheel(jtimer_wheel&&) noexcept = delete;
+        ~jtimer_wheel() = default;
+
+        jtimer_wheel& operator=(const jtimer_wheel&) = delete;
+        jtimer_wheel& operator=(jtimer_wheel&&) noexcept = delete;
+
+        [[nodiscard]] int64 getCurrentTick() const { return currentTick; }
+        [[nodiscard]] int32 getSize() const { return entriesCount; }
+        [[nodiscard]] int32 getScheduledCount() const { return scheduledCount; }
+        // Earliest tick when advance() could do anything, invalid_tick if nothing is scheduled
+        [[nodiscard]] int64 getNextTick() const;
+
+        // Destroys all entries
+        void reset(int64 tick);
+
+        jtimer_handle create(const type& value);
+        bool destroy(const jtimer_handle& handle);
+        [[nodiscard]] type* get(const jtimer_handle& handle);
+
+        // Ticks that are already passed are moved to the next tick
+        bool schedule(const jtimer_handle& handle, int64 expireTick);
+        bool unschedule(const jtimer_handle& handle);
+        [[nodiscard]] bool isScheduled(const jtimer_handle& handle) const;
+        [[nodiscard]] int64 getExpireTick(const jtimer_handle& handle) const;
+
+        // Calls callback(handle, value) for every expired entry, entry is unscheduled before the call.
+        // Callback could modify the wheel, but then the value reference is not valid anymore
+        template<typename Callback>
+        void advance(int64 tick, Callback&& callback);
+        // Calls callback(handle, value) for every entry
+        template<typename Callback>
+        void forEach(Callback&& callback);
+
+    private:
+
+        struct entry_type
+        {
+            type value = type();
+            int64 expireTick = 0;
+            int32 previousEntry = -1;
+            int32 nextEntry = -1;
+            // level * slots_count + slot, -1 if the entry is not scheduled
+            int32 slotIndex = -1;
+            uint32 generation = 0;
+            bool allocated = false;
+        };
+
+        std::vector<entry_type> entries;
+        int32 freeEntry = -1;
+        int32 entriesCount = 0;
+
+        int32 slots[levels_count * slots_count];
+        int32 levelSizes[levels_count];
+        int32 scheduledCount = 0;
+        int64 currentTick = 0;
+
+
+        [[nodiscard]] bool _isValidHandle(const jtimer_handle& handle) const
+        {
+            return (handle.index >= 0) && (handle.index < static_cast<int32>(entries.size()))
+                && entries[handle.index].allocated && (entries[handle.index].generation == handle.generation);
+        }
+        void _resetSlots();
+        void _link(int32 index);
+        void _unlink(int32 index);
+    };
+
+    template<typename T>
+    void jtimer_wheel<T>::_resetSlots()
+    {
+        for (auto& slot : slots)
+        {
+            slot = -1;
+        }
+        for (auto& levelSize : levelSizes)
+        {
+            levelSize = 0;
+        }
+        scheduledCount = 0;
+    }
+    template<typename T>
+    void jtimer_wheel<T>::reset(const int64 tick)
+    {
+        entries.clear();
+        entries.shrink_to_fit();
+        freeEntry = -1;
+        entriesCount = 0;
+        currentTick = tick;
+        _resetSlots();
+    }
+
+    template<typename T>
+    jtimer_handle jtimer_wheel<T>::create(const type& value)
+    {
+        int32 index = freeEntry;
+        if (index >= 0)
+        {
+            freeEntry = entries[index].nextEntry;
+        }
+        else
+        {
+            index = static_cast<int32>(entries.size());
+            entries.emplace_back();
+        }
+
+        entry_type& entry = entries[index];
+        entry.value = value;
+        entry.previousEntry = -1;
+        entry.nextEntry = -1;
+        entry.slotIndex = -1;
+        entry.allocated = true;
+        entriesCount++;
+        return { index, entry.generation };
+    }
+    template<typename T>
+    bool jtimer_wheel<T>::destroy(const jtimer_handle& handle)
+    {
+        if (!_isValidHandle(handle))
+        {
+            return false;
+        }
+
+        entry_type& entry = entries[handle.index];
+        if (entry.slotIndex >= 0)
+        {
+            _unlink(handle.index);
+        }
+        entry.value = type();
+        entry.allocated = false;
+        entry.generation++;
+        entry.nextEntry = freeEntry;
+        freeEntry = handle.index;
+        entriesCount--;
+        return true;
+    }
+    template<typename T>
+    typename jtimer_wheel<T>::type* jtimer_wheel<T>::get(const jtimer_handle& handle)
+    {
+        return _isValidHandle(handle) ? &entries[handle.index].value : nullptr;
+    }
+
+    template<typename T>
+    bool jtimer_wheel<T>::schedule(const jtimer_handle& handle, const int64 expireTick)
+    {
+        if (!_isValidHandle(handle))
+        {
+            return false;
+        }
+
+        if (entries[handle.index].slotIndex >= 0)
+        {
+            _unlink(handle.index);
+        }
+        entries[handle.index].expireTick = expireTick > currentTick ? expireTick : currentTick + 1;
+        _link(handle.index);
+        return true;
+    }
+    template<typename T>
+    bool jtimer_wheel<T>::unschedule(const jtimer_handle& handle)
+    {
+        if (!isScheduled(handle))
+        {
+            return false;
+        }
+        _unlink(handle.index);
+        return true;
+    }
+    template<typename T>
+    bool jtimer_wheel<T>::isScheduled(const jtimer_handle& handle) const
+    {
+        return _isValidHandle(handle) && (entries[handle.index].slotIndex >= 0);
+    }
+    template<typename T>
+    int64 jtimer_wheel<T>::getExpireTick(const jtimer_handle& handle) const
+    {
+        return _isValidHandle(handle) ? entries[handle.index].expireTick : invalid_tick;
+    }
+
+    template<typename T>
+    void jtimer_wheel<T>::_link(const int32 index)
+    {
+        entry_type& entry = entries[index];
+        const int64 delta = entry.expireTick - currentTick;
+        int32 level = 0;
+        while ((level < (levels_count - 1)) && (delta >= (static_cast<int64>(1) << (slot_bits * (level + 1)))))
+        {
+            level++;
+        }
+        // Entries beyond the last level are parked in its farthest slot and linked again when it's cascaded
+        const int64 wheelSpan = static_cast<int64>(1) << (slot_bits * levels_count);
+        const int64 slotTick = delta < wheelSpan ? entry.expireTick : currentTick + wheelSpan - 1;
+        const int32 slotIndex = level * slots_count + static_cast<int32>((slotTick >> (slot_bits * level)) & (slots_count - 1));
+
+        entry.slotIndex = slotIndex;
+        entry.previousEntry = -1;
+        entry.nextEntry = slots[slotIndex];
+        if (entry.nextEntry >= 0)
+        {
+            entries[entry.nextEntry].previousEntry = index;
+        }
+        slots[slotIndex] = index;
+        levelSizes[level]++;
+        scheduledCount++;
+    }
+    template<typename T>
+    void jtimer_wheel<T>::_unlink(const int32 index)
+    {
+        entry_type& entry = entries[index];
+        if (entry.previousEntry >= 0)
+        {
+            entries[entry.previousEntry].nextEntry = entry.nextEntry;
+        }
+        else
+        {
+            slots[entry.slotIndex] = entry.nextEntry;
+        }
+        if (entry.nextEntry >= 0)
+        {
+            entries[entry.nextEntry].previousEntry = entry.previousEntry;
+        }
+        levelSizes[entry.slotIndex / slots_count]--;
+        scheduledCount--;
+        entry.slotIndex = -1;
+        entry.previousEntry = -1;
+        entry.nextEntry = -1;
+    }
+
+    template<typename T>
+    int64 jtimer_wheel<T>::getNextTick() const
+    {
+        if (scheduledCount == 0)
+        {
+            return invalid_tick;
+        }
+
+        // Exact tick for the first level, for others - the tick when their first non-empty slot is cascaded
+        int64 nextTick = invalid_tick;
+        for (int32 level = 0; level < levels_count; level++)
+        {
+            if (levelSizes[level] == 0)
+            {
+                continue;
+            }
+            const int32 levelShift = slot_bits * level;
+            for (int64 offset = 1; offset <= slots_count; offset++)
+            {
+                const int64 slotPosition = (currentTick >> levelShift) + offset;
+                if (slots[level * slots_count + static_cast<int32>(slotPosition & (slots_count - 1))] >= 0)
+                {
+                    nextTick = jutils::math::min(nextTick, slotPosition << levelShift);
+                    break;
+                }
+            }
+        }
+        return nextTick;
+    }
+
+    template<typename T>
+    template<typename Callback>
+    void jtimer_wheel<T>::advance(const int64 tick, Callback&& callback)
+    {
+        while (currentTick < tick)
+        {
+            if (scheduledCount == 0)
+            {
+                currentTick = tick;
+                break;
+            }
+            if (levelSizes[0] == 0)
+            {
+                // Nothing could expire before the next cascade
+                const int64 cascadeTick = ((currentTick >> slot_bits) + 1) << slot_bits;
+                if (cascadeTick > tick)
+                {
+                    currentTick = tick;
+                    break;
+                }
+                currentTick = cascadeTick - 1;
+            }
+            currentTick++;
+
+            for (int32 level = 1; level < levels_count; level++)
+            {
+                const int32 levelShift = slot_bits * level;
+                if ((currentTick & ((static_cast<int64>(1) << levelShift) - 1)) != 0)
+                {
+                    break;
+                }
+                const int32 slotIndex = level * slots_count + static_cast<int32>((currentTick >> levelShift) & (slots_count - 1));
+                int32 index = slots[slotIndex];
+                slots[slotIndex] = -1;
+                while (index >= 0)
+                {
+                    const int32 nextIndex = entries[index].nextEntry;
+                    levelSizes[level]--;
+                    scheduledCount--;
+                    _link(index);
+                    index = nextIndex;
+                }
+            }
+
+            const int32 slotIndex = static_cast<int32>(currentTick & (slots_count - 1));
+            while (slots[slotIndex] >= 0)
+            {
+                const int32 index = slots[slotIndex];
+                _unlink(index);
+                if (entries[index].expireTick > currentTick)
+                {
+                    _link(index);
+                    continue;
+                }
+                callback(jtimer_handle{ index, entries[index].generation }, entries[index].value);
+            }
+        }
+    }
+    template<typename T>
+    template<typename Callback>
+    void jtimer_wheel<T>::forEach(Callback&& callback)
+    {
+        for (int32 index = 0; index < static_cast<int32>(entries.size()); index++)
+        {
+            if (entries[index].allocated)
+            {
+                callback(jtimer_handle{ index, entries[index].generation }, entries[index].value);
+            }
+        }
+    }
+}
@@ -0,0 +1,168 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#pragma once
+
+#include "jmemory.h"
+#include "math/math.h"
+
+#include <atomic>
+#include <type_traits>
+
+namespace jutils
+{
+    // Chase-Lev deque: owner thread calls push()/pop() on the bottom, any thread may steal() from the top
+    template<typename T>
+    class jwork_stealing_deque
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "jwork_stealing_deque supports only trivially copyable types");
+
+    public:
+
+        using type = T;
+
+        explicit jwork_stealing_deque(const int64 capacity = 256)
+        {
+            int64 bufferCapacity = 1;
+            while (bufferCapacity < jutils::math::max(capacity, 2))
+            {
+                bufferCapacity <<= 1;
+            }
+            buffer.store(_createBuffer(bufferCapacity, nullptr), std::memory_order_relaxed);
+        }
+        jwork_stealing_deque(const jwork_stealing_deque&) = delete;
+        jwork_stealing_deque(jwork_stealing_deque&&) noexcept = delete;
+        ~jwork_stealing_deque()
+        {
+            buffer_type* currentBuffer = buffer.load(std::memory_order_relaxed);
+            while (currentBuffer != nullptr)
+            {
+                buffer_type* previousBuffer = currentBuffer->previous;
+                _destroyBuffer(currentBuffer);
+                currentBuffer = previousBuffer;
+            }
+        }
+
+        jwork_stealing_deque& operator=(const jwork_stealing_deque&) = delete;
+        jwork_stealing_deque& operator=(jwork_stealing_deque&&) noexcept = delete;
+
+        [[nodiscard]] int64 getSize() const
+        {
+            const int64 bottomIndex = bottom.load(std::memory_order_relaxed);
+            const int64 topIndex = top.load(std::memory_order_relaxed);
+            return jutils::math::max(bottomIndex - topIndex, 0);
+        }
+        [[nodiscard]] bool isEmpty() const { return getSize() == 0; }
+
+        void push(type value);
+        bool pop(type& outValue);
+        bool steal(type& outValue);
+
+    private:
+
+        struct buffer_type
+        {
+            int64 capacity = 0;
+            std::atomic<type>* data = nullptr;
+            buffer_type* previous = nullptr;
+
+            [[nodiscard]] type get(const int64 index) const { return data[index & (capacity - 1)].load(std::memory_order_relaxed); }
+            void put(const int64 index, const type value) { data[index & (capacity - 1)].store(value, std::memory_order_relaxed); }
+        };
+
+        alignas(memory::cache_line_size) std::atomic<int64> top = 0;
+        alignas(memory::cache_line_size) std::atomic<int64> bottom = 0;
+        std::atomic<buffer_type*> buffer = nullptr;
+
+
+        [[nodiscard]] static buffer_type* _createBuffer(int64 capacity, buffer_type* previousBuffer);
+        static void _destroyBuffer(buffer_type* oldBuffer);
+    };
+
+    template<typename T>
+    void jwork_stealing_deque<T>::push(const type value)
+    {
+        const int64 bottomIndex = bottom.load(std::memory_order_relaxed);
+        const int64 topIndex = top.load(std::memory_order_acquire);
+        buffer_type* currentBuffer = buffer.load(std::memory_order_relaxed);
+        if ((bottomIndex - topIndex) >= (currentBuffer->capacity - 1))
+        {
+            // Old buffers stay alive until destruction because thieves may still read from them
+            buffer_type* newBuffer = _createBuffer(currentBuffer->capacity * 2, currentBuffer);
+            for (int64 index = topIndex; index < bottomIndex; index++)
+            {
+                newBuffer->put(index, currentBuffer->get(index));
+            }
+            buffer.store(newBuffer, std::memory_order_release);
+            currentBuffer = newBuffer;
+        }
+        currentBuffer->put(bottomIndex, value);
+        bottom.store(bottomIndex + 1, std::memory_order_release);
+    }
+    template<typename T>
+    bool jwork_stealing_deque<T>::pop(type& outValue)
+    {
+        const int64 bottomIndex = bottom.load(std::memory_order_relaxed) - 1;
+        buffer_type* currentBuffer = buffer.load(std::memory_order_relaxed);
+        bottom.store(bottomIndex, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64 topIndex = top.load(std::memory_order_relaxed);
+        if (topIndex > bottomIndex)
+        {
+            bottom.store(bottomIndex + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        outValue = currentBuffer->get(bottomIndex);
+        if (topIndex != bottomIndex)
+        {
+            return true;
+        }
+
+        // Last element, race with thieves for it
+        const bool success = top.compare_exchange_strong(topIndex, topIndex + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(bottomIndex + 1, std::memory_order_relaxed);
+        return success;
+    }
+    template<typename T>
+    bool jwork_stealing_deque<T>::steal(type& outValue)
+    {
+        int64 topIndex = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64 bottomIndex = bottom.load(std::memory_order_acquire);
+        if (topIndex >= bottomIndex)
+        {
+            return false;
+        }
+
+        const buffer_type* currentBuffer = buffer.load(std::memory_order_acquire);
+        const type value = currentBuffer->get(topIndex);
+        if (!top.compare_exchange_strong(topIndex, topIndex + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return false;
+        }
+        outValue = value;
+        return true;
+    }
+
+    template<typename T>
+    typename jwork_stealing_deque<T>::buffer_type* jwork_stealing_deque<T>::_createBuffer(const int64 capacity, buffer_type* previousBuffer)
+    {
+        buffer_type* newBuffer = memory::allocate<buffer_type>(1);
+        memory::construct(newBuffer);
+        newBuffer->capacity = capacity;
+        newBuffer->data = memory::allocate<std::atomic<type>>(static_cast<int32>(capacity));
+        for (int64 index = 0; index < capacity; index++)
+        {
+            memory::construct(newBuffer->data + index);
+        }
+        newBuffer->previous = previousBuffer;
+        return newBuffer;
+    }
+    template<typename T>
+    void jwork_stealing_deque<T>::_destroyBuffer(buffer_type* oldBuffer)
+    {
+        memory::deallocate(oldBuffer->data, static_cast<int32>(oldBuffer->capacity));
+        memory::destruct(oldBuffer);
+        memory::deallocate(oldBuffer, 1);
+    }
+}
@@ -0,0 +1,111 @@
+﻿// Copyright © 2023 Leonov Maksim. All Rights Reserved.
+
+#include <jutils/jasync_task_queue.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace jutils;
+
+namespace
+{
+    // Worker 0 executes only high priority tasks, other workers execute everything else
+    class lane_worker : public jasync_worker
+    {
+    public:
+        bool canExecuteTasks(const jasync_task_priority priority) const
+        {
+            return (getWorkerIndex() == 0) == (priority == jasync_task_priority::high);
+        }
+    };
+
+    class batch_task : public jasync_task
+    {
+    public:
+        virtual void run() override {}
+        [[nodiscard]] virtual bool shouldDeleteAfterExecution() const override { return false; }
+    };
+
+    // Tasks are not awaited by wait(), it would execute them on the calling thread regardless of lanes
+    bool waitForCounter(const jasync_task_counter& counter)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!counter.isDone() && (std::chrono::steady_clock::now() < deadline))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return counter.isDone();
+    }
+
+    bool testRestrictedLanesSingleTasks()
+    {
+        for (int32 iteration = 0; iteration < 10; iteration++)
+        {
+            jasync_task_queue<lane_worker> queue;
+            if (!queue.init(2))
+            {
+                return false;
+            }
+            // Lets both workers park before the first task
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            jasync_task_counter counter;
+            for (int32 index = 0; index < 40; index++)
+            {
+                queue.addTask([]() {}, jasync_task_priority::normal, &counter);
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            const bool finished = waitForCounter(counter);
+            const int32 stuckCount = counter.getPendingCount();
+            queue.stop(true);
+            if (!finished)
+            {
+                std::printf("iteration %d: %d of 40 tasks are stuck\n", iteration, stuckCount);
+                return false;
+            }
+        }
+        return true;
+    }
+    bool testRestrictedLanesBatches()
+    {
+        for (int32 iteration = 0; iteration < 10; iteration++)
+        {
+            // Batch is smaller than the count of parked workers, and only one of them executes it
+            jasync_task_queue<lane_worker> queue;
+            if (!queue.init(4))
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            jasync_task_counter counter;
+            for (int32 index = 0; index < 10; index++)
+            {
+                batch_task tasks[2];
+                queue.addTasks(tasks, 2, jasync_task_priority::high, &counter);
+                if (!waitForCounter(counter))
+                {
+                    std::printf("iteration %d: batch %d is stuck\n", iteration, index);
+                    queue.stop(true);
+                    return false;
+                }
+            }
+            queue.stop(true);
+        }
+        return true;
+    }
+}
+
+int main()
+{
+    int32 failedCount = 0;
+    auto check = [&failedCount](const char* name, const bool passed)
+    {
+        std::printf("%s: %s\n", name, passed ? "passed" : "FAILED");
+        failedCount += passed ? 0 : 1;
+    };
+    check("restricted lanes, single tasks", testRestrictedLanesSingleTasks());
+    check("restricted lanes, batches", testRestrictedLanesBatches());
+    return failedCount == 0 ? 0 : 1;
+}